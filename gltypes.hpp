@@ -44,9 +44,21 @@ typedef void *GLeglClientBufferEXT;
 // types needed for X
 typedef unsigned long XID;
 typedef XID GLXDrawable;
+typedef void *GLXContext;
 
 // types for EGL
 typedef unsigned int EGLBoolean;
 typedef void *EGLDisplay;
 typedef void *EGLSurface;
+typedef void *EGLContext;
 typedef int32_t EGLint;
+
+// GL enums used by the blackbox itself; values are shared
+// with the _EXT variants of EXT_disjoint_timer_query
+#define GL_QUERY_RESULT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#define GL_TIMESTAMP 0x8E28
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#define GL_VERSION 0x1F02
+#define GL_EXTENSIONS 0x1F03
+#define GL_NUM_EXTENSIONS 0x821D
@@ -23,16 +23,21 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <list>
+#include <map>
 #include <assert.h>
 #include <dlfcn.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include "function_fetcher.hpp"
 #include "gltypes.hpp"
+#include "log_index.hpp"
+#include "log_delta.hpp"
 
 #include "i965_batchbuffer_logger_app.h"
 #include "i965_batchbuffer_logger_output.h"
@@ -66,6 +71,41 @@
  * - I965_BLACKBOX_EGL_LIB name of EGL .so to use to load EGL symbols;
  *                         if not set, use the value "libEGL.so"
  *
+ * - I965_BLACKBOX_GPU_FRAME_TIMING if non-zero, gives the number of GL
+ *                                  timestamp queries in a ring used to
+ *                                  measure the GPU time of each frame;
+ *                                  a query is issued at each
+ *                                  glXSwapBuffers/eglSwapBuffers and read
+ *                                  back once available (never stalling),
+ *                                  typically several frames later. Each
+ *                                  GL context swapped has a ring of its
+ *                                  own. The GPU time of a frame is written
+ *                                  to the log as a value message named by
+ *                                  the macro GPU_FRAME_TIME_MESSAGE_NAME.
+ *                                  If the ring is full at a frame
+ *                                  boundary, that frame is not timed.
+ *                                  Default is 0 (disabled).
+ *
+ * - I965_BLACKBOX_INDEX if non-zero, write next to each log file an index
+ *                       file giving where each frame and execbuffer2 ioctl
+ *                       starts in the log file (see log_index.hpp); used
+ *                       by i965-extract to extract ranges of a log without
+ *                       scanning it. Default is 1.
+ *
+ * - I965_BLACKBOX_DELTA_KEYFRAME_INTERVAL if non-zero, delta encode the log
+ *                                         (see log_delta.hpp): the messages
+ *                                         of each execbuffer2 ioctl, and
+ *                                         those between two ioctls, are
+ *                                         written as the values that changed
+ *                                         from the most recent such messages
+ *                                         with the same sequence of names,
+ *                                         with a full keyframe every this
+ *                                         many records and at the start of each
+ *                                         file; the index file gives where the
+ *                                         keyframes are so that decoding can
+ *                                         start there. Default is 0 (no
+ *                                         encoding).
+ *
  * Interception Notes:
  *  The methodology for interception of GL/GLES API calls
  *  is taken from apitrace (https://github.com/apitrace/apitrace).
@@ -120,6 +160,9 @@
 // default max number of frames before starting new file
 #define DEFAULT_MAX_FRAMES_PER_FILE 100
 
+// name of the value message giving the GPU time of a frame
+#define GPU_FRAME_TIME_MESSAGE_NAME "GPU frame time"
+
 ////////////////////////////////////
 // Global vomit.
 static struct i965_batchbuffer_logger_app *logger_app = NULL;
@@ -129,6 +172,10 @@ static long max_filesize = 0;
 static unsigned int numframes_per_file;
 static unsigned int frame_count = 0;
 static unsigned int api_count = 0;
+static unsigned int total_frame_count = 0;
+static unsigned int gpu_frame_timing_ring_size = 0;
+static bool write_index = true;
+static unsigned int delta_keyframe_interval = 0;
 static bool prefer_gl_sym = true;
 
 
@@ -202,10 +249,42 @@ public:
   {
     return m_value.size();
   }
+
+  /* offset of the BLOCK_BEGIN message of the
+   * block in the current file of the Session
+   */
+  uint64_t
+  offset(void) const
+  {
+    return m_offset;
+  }
+
+  void
+  set_offset(uint64_t v)
+  {
+    m_offset = v;
+  }
+
+  /* number of the block in its Session, to tell
+   * apart blocks with the same name and value
+   */
+  uint64_t
+  serial(void) const
+  {
+    return m_serial;
+  }
+
+  void
+  set_serial(uint64_t v)
+  {
+    m_serial = v;
+  }
   
 private:
   std::vector<uint8_t> m_name;
   std::vector<uint8_t> m_value;
+  uint64_t m_offset;
+  uint64_t m_serial;
 };
 
 class Session
@@ -236,20 +315,38 @@ public:
   struct i965_batchbuffer_logger_session
   start_session(unsigned int most_recent_ioctl_max,
                 struct i965_batchbuffer_logger_app *app,
-                long max_filesize)
+                long max_filesize, bool write_index,
+                unsigned int delta_keyframe_interval)
   {
     struct i965_batchbuffer_logger_session_params params;
-    params.client_data = new Session(most_recent_ioctl_max, max_filesize);
+    params.client_data = new Session(most_recent_ioctl_max, max_filesize,
+                                     write_index, delta_keyframe_interval);
     params.write = &Session::write_fcn;
     params.close = &Session::close_fcn;
     params.pre_execbuffer2_ioctl = &Session::pre_execbuffer2_ioctl_fcn;
     params.post_execbuffer2_ioctl = &Session::post_execbuffer2_ioctl_fcn;
     return app->begin_session(app, &params);
   }
+
+  /* Write a value message to the most recently started
+   * Session that is still alive; does nothing if there
+   * is no such Session or if it does not have a file open.
+   */
+  static
+  void
+  write_value(const std::string &name, const std::string &value);
+
+  /* Record in the index of the most recently started
+   * Session that is still alive that a frame starts.
+   */
+  static
+  void
+  mark_frame(unsigned int frame);
   
 private:
   Session(unsigned int most_recent_ioctl_max,
-          long max_filesize);
+          long max_filesize, bool write_index,
+          unsigned int delta_keyframe_interval);
 
 void
   start_new_file(void);
@@ -262,8 +359,23 @@ void
                 const void *name, uint32_t name_length,
                 const void *value, uint32_t value_length);
 
+  void
+  write_raw(enum i965_batchbuffer_logger_message_type_t tp,
+            const void *name, uint32_t name_length,
+            const void *value, uint32_t value_length);
+
+  void
+  write_index_entry(const char *kind, unsigned int id);
+
+  void
+  begin_record(void);
+
+  void
+  end_record(void);
+
   unsigned int m_most_recent_ioctl_max;
   long m_max_filesize;
+  bool m_write_index;
   unsigned int m_count;
 
   unsigned int m_most_recent_ioctl_file_cnt;
@@ -275,23 +387,65 @@ void
    * new file; m_block_stack holds the block structure.
    */
   std::vector<Block> m_block_stack;
+  uint64_t m_block_serial;
+
+  /* serials of the blocks closed at the end of the previous
+   * file; in most recent mode the blocks restored at the start
+   * of the next file need not be the same blocks.
+   */
+  std::vector<uint64_t> m_closed_blocks;
+
   std::string m_prefix;
   std::string m_filename;
   std::FILE *m_file;
+  std::FILE *m_index_file;
+
+  /* offset into m_file tracked by write_raw(), so that
+   * std::ftell() is not called for each block, and offset
+   * into the log as decoded tracked by write_to_file(), used
+   * by the index; they differ only when delta encoding.
+   */
+  uint64_t m_file_offset;
+  uint64_t m_log_offset;
+
+  /* when delta encoding, the messages of a record (those of
+   * an execbuffer2 ioctl or those between two such ioctls) are
+   * held in m_record and written encoded when the record ends
+   * or the file is closed.
+   */
+  DeltaEncoder m_delta;
+  bool m_recording;
+  LogRecord m_record;
+  uint64_t m_record_offset;
+  unsigned int m_num_keyframes;
+
+  static Session *s_active;
 };
 
 } //anonymous namespace
 
 //////////////////////////////////////////
 // Session methods
+Session *Session::s_active = nullptr;
+
 Session::
 Session(unsigned int most_recent_ioctl_max,
-        long max_filesize):
+        long max_filesize, bool write_index,
+        unsigned int delta_keyframe_interval):
   m_most_recent_ioctl_max(most_recent_ioctl_max),
   m_max_filesize(max_filesize),
+  m_write_index(write_index),
   m_count(0),
   m_most_recent_ioctl_file_cnt(0),
-  m_file(nullptr)
+  m_block_serial(0),
+  m_file(nullptr),
+  m_index_file(nullptr),
+  m_file_offset(0),
+  m_log_offset(0),
+  m_delta(delta_keyframe_interval),
+  m_recording(false),
+  m_record_offset(0),
+  m_num_keyframes(0)
 {
   static unsigned int count(0);
   std::string filename_prefix;
@@ -309,12 +463,100 @@ Session(unsigned int most_recent_ioctl_max,
     }
   std::printf("i965-blackbox: Start new session \"%s\"\n", m_prefix.c_str());
   start_new_file();
+  s_active = this;
 }
 
 Session::
 ~Session()
 {
   close_file();
+  if (s_active == this)
+    {
+      s_active = nullptr;
+    }
+}
+
+void
+Session::
+write_value(const std::string &name, const std::string &value)
+{
+  if (s_active)
+    {
+      s_active->write_to_file(I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE,
+                              name.c_str(), name.length(),
+                              value.c_str(), value.length());
+    }
+}
+
+void
+Session::
+mark_frame(unsigned int frame)
+{
+  if (s_active)
+    {
+      s_active->write_index_entry(LOG_INDEX_FRAME, frame);
+    }
+}
+
+void
+Session::
+write_index_entry(const char *kind, unsigned int id)
+{
+  if (!m_index_file)
+    {
+      return;
+    }
+
+  LogIndexEntry entry;
+
+  entry.m_kind = kind;
+  entry.m_id = id;
+  entry.m_offset = m_log_offset;
+  entry.m_block_offsets.reserve(m_block_stack.size());
+  for (auto iter = m_block_stack.begin(); iter != m_block_stack.end(); ++iter)
+    {
+      entry.m_block_offsets.push_back(iter->offset());
+    }
+  entry.write(m_index_file);
+}
+
+void
+Session::
+begin_record(void)
+{
+  m_recording = m_delta.enabled() && m_file;
+  m_record_offset = m_log_offset;
+}
+
+void
+Session::
+end_record(void)
+{
+  if (!m_recording)
+    {
+      return;
+    }
+
+  LogRecord out;
+
+  m_recording = false;
+  if (m_delta.encode(m_record, &out) && m_index_file)
+    {
+      LogIndexEntry entry;
+
+      entry.m_kind = LOG_INDEX_KEYFRAME;
+      entry.m_id = m_num_keyframes++;
+      entry.m_offset = m_record_offset;
+      entry.m_block_offsets.push_back(m_file_offset);
+      entry.write(m_index_file);
+    }
+  m_record.clear();
+  for (auto iter = out.begin(); iter != out.end(); ++iter)
+    {
+      write_raw(iter->m_type,
+                iter->m_name.data(), iter->m_name.length(),
+                iter->m_value.data(), iter->m_value.length());
+    }
 }
 
 void
@@ -326,6 +568,13 @@ close_file(void)
       return;
     }
 
+  end_record();
+  write_index_entry(LOG_INDEX_CLOSE, m_count - 1);
+  m_closed_blocks.clear();
+  for (auto iter = m_block_stack.begin(); iter != m_block_stack.end(); ++iter)
+    {
+      m_closed_blocks.push_back(iter->serial());
+    }
   for (auto iter = m_block_stack.rbegin(); iter != m_block_stack.rend(); ++iter)
     {
       write_to_file(I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_END, nullptr, 0, nullptr, 0);
@@ -336,6 +585,12 @@ close_file(void)
   std::fclose(m_file);
   m_file = nullptr;
 
+  if (m_index_file)
+    {
+      std::fclose(m_index_file);
+      m_index_file = nullptr;
+    }
+
   if (m_most_recent_ioctl_max > 0)
     {
       while (m_most_recent_ioctl_file_cnt >= m_most_recent_ioctl_max)
@@ -344,6 +599,7 @@ close_file(void)
 
           file_to_delete = m_most_recent_ioctl_files.front();
           std::remove(file_to_delete.c_str());
+          std::remove(log_index_filename(file_to_delete).c_str());
           m_most_recent_ioctl_files.pop_front();
           --m_most_recent_ioctl_file_cnt;
         }
@@ -363,14 +619,43 @@ start_new_file(void)
    str << m_prefix << "." << m_count++;
    m_filename = str.str();
    m_file = std::fopen(m_filename.c_str(), "w");
+   m_file_offset = 0;
+   m_log_offset = 0;
+   m_num_keyframes = 0;
+   if (m_write_index)
+     {
+       m_index_file = std::fopen(log_index_filename(m_filename).c_str(), "w");
+     }
    std::printf("i965-blackbox: Start new file \"%s\" at api-call #%u\n", m_filename.c_str(), api_count);
    std::fflush(stdout);
+   if (m_delta.enabled())
+     {
+       LogRecord out;
+
+       m_delta.begin_file(&out);
+       for (auto iter = out.begin(); iter != out.end(); ++iter)
+         {
+           write_raw(iter->m_type,
+                     iter->m_name.data(), iter->m_name.length(),
+                     iter->m_value.data(), iter->m_value.length());
+         }
+     }
    for (auto iter = m_block_stack.begin(); iter != m_block_stack.end(); ++iter)
      {
+       iter->set_offset(m_log_offset);
        write_to_file(I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN,
                      iter->name(), iter->name_length(),
                      iter->value(), iter->value_length());
      }
+
+   unsigned int num_continued(0);
+   while (num_continued < m_block_stack.size()
+          && num_continued < m_closed_blocks.size()
+          && m_block_stack[num_continued].serial() == m_closed_blocks[num_continued])
+     {
+       ++num_continued;
+     }
+   write_index_entry(LOG_INDEX_OPEN, num_continued);
 }
 
 void
@@ -384,6 +669,30 @@ write_to_file(enum i965_batchbuffer_logger_message_type_t tp,
        return;
      }
 
+   m_log_offset += sizeof(struct i965_batchbuffer_logger_header)
+     + name_length + value_length;
+   if (m_recording)
+     {
+       m_record.push_back(LogMessage());
+       m_record.back().m_type = tp;
+       m_record.back().m_name.assign(static_cast<const char*>(name), name_length);
+       m_record.back().m_value.assign(static_cast<const char*>(value), value_length);
+       return;
+     }
+   write_raw(tp, name, name_length, value, value_length);
+}
+
+void
+Session::
+write_raw(enum i965_batchbuffer_logger_message_type_t tp,
+          const void *name, uint32_t name_length,
+          const void *value, uint32_t value_length)
+{
+   if (!m_file)
+     {
+       return;
+     }
+
    struct i965_batchbuffer_logger_header hdr;
 
    hdr.type = tp;
@@ -400,6 +709,8 @@ write_to_file(enum i965_batchbuffer_logger_message_type_t tp,
      {
        std::fwrite(value, sizeof(char), value_length, m_file);
      }
+
+   m_file_offset += sizeof(hdr) + name_length + value_length;
 }
 
 void
@@ -418,9 +729,12 @@ pre_execbuffer2_ioctl_fcn(void *pthis, unsigned int id)
   Session *p;
   p = static_cast<Session*>(pthis);
 
+  p->end_record();
   if (p->m_most_recent_ioctl_max > 0)
     {
       p->start_new_file();
+      p->write_index_entry(LOG_INDEX_IOCTL, id);
+      p->begin_record();
       return;
     }
 
@@ -437,7 +751,13 @@ pre_execbuffer2_ioctl_fcn(void *pthis, unsigned int id)
     {
       std::printf("i965-blackbox: flush file \"%s\"\n", p->m_filename.c_str());
       std::fflush(p->m_file);
+      if (p->m_index_file)
+        {
+          std::fflush(p->m_index_file);
+        }
     }
+  p->write_index_entry(LOG_INDEX_IOCTL, id);
+  p->begin_record();
 }
 
 void
@@ -447,6 +767,11 @@ post_execbuffer2_ioctl_fcn(void *pthis, unsigned int id)
   Session *p;
   p = static_cast<Session*>(pthis);
 
+  /* write the record of the ioctl before flushing so that
+   * it is in the log if the GPU hangs or the application
+   * crashes.
+   */
+  p->end_record();
   if (p->m_file)
     {
       if (p->m_most_recent_ioctl_max > 0)
@@ -459,6 +784,7 @@ post_execbuffer2_ioctl_fcn(void *pthis, unsigned int id)
           std::fflush(p->m_file);
         }
     }
+  p->begin_record();
 }
 
 void
@@ -476,6 +802,8 @@ write_fcn(void *pthis,
      case I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN:
        p->m_block_stack.push_back(Block());
        p->m_block_stack.back().set(name, name_length, value, value_length);
+       p->m_block_stack.back().set_offset(p->m_log_offset);
+       p->m_block_stack.back().set_serial(p->m_block_serial++);
        break;
 
      case I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_END:
@@ -549,6 +877,432 @@ fetch_function(const char *name)
 #undef FUNCTION_ENTRY
 #undef FUNCTION_ENTRY_RET
 
+namespace {
+
+/* A ContextFrameTimer issues a GL timestamp query at each frame
+ * boundary of a GL context and reads the results back without
+ * stalling: the
+ * queries live in a ring and a query is only read once GL
+ * reports its result as available. The GPU time of a frame
+ * is the difference between the timestamps of consecutive
+ * frame boundaries. The GL functions are called through the
+ * _glFoo pointers so that they are not reported to the logger
+ * as API calls of the application. The queries are created at
+ * the first frame boundary of the context, if the context
+ * supports timestamp queries (GL 3.3, ARB_timer_query
+ * or, for GLES, EXT_disjoint_timer_query). For GLES, the
+ * timestamps read when GL reports a disjoint operation (for
+ * example a change of GPU frequency) are dropped.
+ */
+class ContextFrameTimer
+{
+public:
+  ContextFrameTimer(unsigned int ring_size, unsigned int context_id);
+
+  /* To be called with the context current at each frame
+   * boundary; api_call_id is the ID of the swap call.
+   */
+  void
+  frame_boundary(unsigned int api_call_id);
+
+private:
+  class Query
+  {
+  public:
+    GLuint m_name;
+    unsigned int m_frame;
+    unsigned int m_api_call_id;
+  };
+
+  typedef void (*gen_queries_type)(GLsizei, GLuint*);
+  typedef void (*query_counter_type)(GLuint, GLenum);
+  typedef void (*get_query_objectiv_type)(GLuint, GLenum, GLint*);
+  typedef void (*get_query_objectui64v_type)(GLuint, GLenum, GLuint64*);
+
+  void
+  init_queries(void);
+
+  bool
+  timestamp_queries_supported(void);
+
+  bool
+  has_extension(int major_version, const char *name);
+
+  void
+  retire_available_queries(void);
+
+  void
+  record_timestamp(const Query &q, GLuint64 timestamp);
+
+  unsigned int m_ring_size;
+  unsigned int m_context_id;
+  bool m_initialized;
+  bool m_check_disjoint;
+  std::vector<Query> m_queries;
+  unsigned int m_oldest, m_num_pending;
+  unsigned int m_frame;
+
+  bool m_have_previous;
+  unsigned int m_previous_frame;
+  GLuint64 m_previous_timestamp;
+
+  query_counter_type m_query_counter;
+  get_query_objectiv_type m_get_query_objectiv;
+  get_query_objectui64v_type m_get_query_objectui64v;
+};
+
+/* A GpuFrameTimer times the frames of each GL context swapped
+ * with a ContextFrameTimer of its own, as query objects belong
+ * to the context that created them; a swap without a current
+ * context is not timed.
+ */
+class GpuFrameTimer
+{
+public:
+  explicit
+  GpuFrameTimer(unsigned int ring_size):
+    m_ring_size(ring_size),
+    m_num_contexts(0)
+  {}
+
+  /* To be called just before the swap is forwarded to GL/EGL
+   * and after the logger is told of the swap call, so that the
+   * GPU commands of the query are logged within the swap;
+   * api_call_id is the ID of the swap call.
+   */
+  void
+  frame_boundary(unsigned int api_call_id);
+
+  /* To be called when a context is destroyed, as its
+   * queries are destroyed with it.
+   */
+  void
+  context_destroyed(void *context);
+
+private:
+  void*
+  current_context(void);
+
+  unsigned int m_ring_size;
+  unsigned int m_num_contexts;
+  std::map<void*, ContextFrameTimer*> m_contexts;
+};
+
+} //anonymous namespace
+
+static GpuFrameTimer *gpu_frame_timer = nullptr;
+
+//////////////////////////////////////////
+// ContextFrameTimer methods
+ContextFrameTimer::
+ContextFrameTimer(unsigned int ring_size, unsigned int context_id):
+  m_ring_size(ring_size),
+  m_context_id(context_id),
+  m_initialized(false),
+  m_check_disjoint(false),
+  m_oldest(0),
+  m_num_pending(0),
+  m_frame(0),
+  m_have_previous(false),
+  m_previous_frame(0),
+  m_previous_timestamp(0),
+  m_query_counter(nullptr),
+  m_get_query_objectiv(nullptr),
+  m_get_query_objectui64v(nullptr)
+{
+  assert(m_ring_size > 0);
+}
+
+void
+ContextFrameTimer::
+init_queries(void)
+{
+  gen_queries_type gen_queries;
+  std::vector<GLuint> names(m_ring_size, 0);
+
+  m_initialized = true;
+  if (!timestamp_queries_supported())
+    {
+      std::printf("i965-blackbox: GL context #%u does not support timestamp "
+                  "queries, GPU frame timing disabled for it\n", m_context_id);
+      return;
+    }
+
+  /* GLES only has timestamp queries via EXT_disjoint_timer_query */
+  m_check_disjoint = !prefer_gl_sym;
+  if (prefer_gl_sym)
+    {
+      gen_queries = _glGenQueries;
+      m_query_counter = _glQueryCounter;
+      m_get_query_objectiv = _glGetQueryObjectiv;
+      m_get_query_objectui64v = _glGetQueryObjectui64v;
+    }
+  else
+    {
+      gen_queries = _glGenQueriesEXT;
+      m_query_counter = _glQueryCounterEXT;
+      m_get_query_objectiv = _glGetQueryObjectivEXT;
+      m_get_query_objectui64v = _glGetQueryObjectui64vEXT;
+    }
+
+  gen_queries(m_ring_size, &names[0]);
+  for (unsigned int i = 0; i < m_ring_size; ++i)
+    {
+      if (names[i] == 0)
+        {
+          std::printf("i965-blackbox: unable to create timestamp queries, "
+                      "GPU frame timing disabled for GL context #%u\n",
+                      m_context_id);
+          return;
+        }
+    }
+
+  m_queries.resize(m_ring_size);
+  for (unsigned int i = 0; i < m_ring_size; ++i)
+    {
+      m_queries[i].m_name = names[i];
+    }
+  std::printf("i965-blackbox: GPU frame timing of GL context #%u with "
+              "%u timestamp queries\n", m_context_id, m_ring_size);
+}
+
+bool
+ContextFrameTimer::
+timestamp_queries_supported(void)
+{
+  const char *version;
+  int major(0), minor(0);
+
+  version = reinterpret_cast<const char*>(_glGetString(GL_VERSION));
+  if (!version)
+    {
+      return false;
+    }
+
+  /* GLES version strings are of the form "OpenGL ES N.M ..." */
+  while (*version && !std::isdigit(*version))
+    {
+      ++version;
+    }
+  std::sscanf(version, "%d.%d", &major, &minor);
+
+  if (prefer_gl_sym)
+    {
+      return major > 3 || (major == 3 && minor >= 3)
+        || has_extension(major, "GL_ARB_timer_query");
+    }
+  return has_extension(major, "GL_EXT_disjoint_timer_query");
+}
+
+bool
+ContextFrameTimer::
+has_extension(int major_version, const char *name)
+{
+  /* GL_EXTENSIONS is not a valid glGetString() enum in
+   * core profiles, so query each extension from GL 3.0 on.
+   */
+  if (major_version >= 3)
+    {
+      GLint count(0);
+
+      _glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+      for (GLint i = 0; i < count; ++i)
+        {
+          const char *ext;
+
+          ext = reinterpret_cast<const char*>(_glGetStringi(GL_EXTENSIONS, i));
+          if (ext && std::strcmp(ext, name) == 0)
+            {
+              return true;
+            }
+        }
+      return false;
+    }
+
+  const char *exts;
+  exts = reinterpret_cast<const char*>(_glGetString(GL_EXTENSIONS));
+  if (!exts)
+    {
+      return false;
+    }
+
+  std::istringstream str(exts);
+  std::string ext;
+  while (str >> ext)
+    {
+      if (ext == name)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+ContextFrameTimer::
+retire_available_queries(void)
+{
+  std::vector<std::pair<Query, GLuint64> > results;
+
+  while (m_num_pending > 0)
+    {
+      const Query &q(m_queries[m_oldest]);
+      GLint available(0);
+      GLuint64 timestamp(0);
+
+      m_get_query_objectiv(q.m_name, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available)
+        {
+          break;
+        }
+
+      m_get_query_objectui64v(q.m_name, GL_QUERY_RESULT, &timestamp);
+      results.push_back(std::make_pair(q, timestamp));
+      m_oldest = (m_oldest + 1) % m_ring_size;
+      --m_num_pending;
+    }
+
+  /* GL_GPU_DISJOINT_EXT is read after the results, as it tells
+   * if the results read since it was last read are meaningless;
+   * the pending queries are dropped too, they are reissued by
+   * later frame boundaries.
+   */
+  if (m_check_disjoint)
+    {
+      GLint disjoint(0);
+
+      _glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+      if (disjoint)
+        {
+          std::printf("i965-blackbox: GPU disjoint operation, dropping "
+                      "%u GPU frame timestamps\n",
+                      static_cast<unsigned int>(results.size()) + m_num_pending);
+          m_oldest = (m_oldest + m_num_pending) % m_ring_size;
+          m_num_pending = 0;
+          m_have_previous = false;
+          return;
+        }
+    }
+
+  for (auto iter = results.begin(); iter != results.end(); ++iter)
+    {
+      record_timestamp(iter->first, iter->second);
+    }
+}
+
+void
+ContextFrameTimer::
+record_timestamp(const Query &q, GLuint64 timestamp)
+{
+  /* a frame is only timed if the query of the frame
+   * boundary before it was also issued and read.
+   */
+  if (m_have_previous && q.m_frame == m_previous_frame + 1)
+    {
+      std::ostringstream str;
+      GLuint64 gpu_time;
+
+      gpu_time = timestamp - m_previous_timestamp;
+      str << "context=" << m_context_id
+          << " frame=" << q.m_frame
+          << " api-call=" << q.m_api_call_id
+          << " gpu-ns=" << gpu_time;
+      Session::write_value(GPU_FRAME_TIME_MESSAGE_NAME, str.str());
+      std::printf("i965-blackbox: GL context #%u frame #%u ending at api-call #%u "
+                  "GPU time %" PRIu64 " ns\n",
+                  m_context_id, q.m_frame, q.m_api_call_id, gpu_time);
+    }
+
+  m_have_previous = true;
+  m_previous_frame = q.m_frame;
+  m_previous_timestamp = timestamp;
+}
+
+void
+ContextFrameTimer::
+frame_boundary(unsigned int api_call_id)
+{
+  if (!m_initialized)
+    {
+      init_queries();
+    }
+
+  if (m_queries.empty())
+    {
+      return;
+    }
+
+  retire_available_queries();
+  if (m_num_pending < m_ring_size)
+    {
+      Query &q(m_queries[(m_oldest + m_num_pending) % m_ring_size]);
+
+      q.m_frame = m_frame;
+      q.m_api_call_id = api_call_id;
+      m_query_counter(q.m_name, GL_TIMESTAMP);
+      ++m_num_pending;
+    }
+  ++m_frame;
+}
+
+//////////////////////////////////////////
+// GpuFrameTimer methods
+void*
+GpuFrameTimer::
+current_context(void)
+{
+  typedef void* (*fptr_type)(void);
+  static fptr_type glx_fptr = nullptr, egl_fptr = nullptr;
+
+  if (prefer_gl_sym)
+    {
+      if (glx_fptr == nullptr)
+        {
+          glx_fptr = (fptr_type)gl_dlsym("glXGetCurrentContext");
+        }
+      return glx_fptr ? glx_fptr() : nullptr;
+    }
+
+  if (egl_fptr == nullptr)
+    {
+      egl_fptr = (fptr_type)egl_dlsym("eglGetCurrentContext");
+    }
+  return egl_fptr ? egl_fptr() : nullptr;
+}
+
+void
+GpuFrameTimer::
+frame_boundary(unsigned int api_call_id)
+{
+  void *context;
+
+  context = current_context();
+  if (!context)
+    {
+      return;
+    }
+
+  ContextFrameTimer *&timer(m_contexts[context]);
+  if (!timer)
+    {
+      timer = new ContextFrameTimer(m_ring_size, ++m_num_contexts);
+    }
+  timer->frame_boundary(api_call_id);
+}
+
+void
+GpuFrameTimer::
+context_destroyed(void *context)
+{
+  auto iter = m_contexts.find(context);
+
+  if (iter != m_contexts.end())
+    {
+      delete iter->second;
+      m_contexts.erase(iter);
+    }
+}
+
 #define FUNCTION_ENTRY(name, type_arg_list, arg_list)              \
   extern "C" void name type_arg_list                               \
   {                                                                \
@@ -645,6 +1399,11 @@ glXSwapBuffers(void *dpy, GLXDrawable drawable)
        logger_app->pre_call(logger_app, api_count, "glXSwapBuffers", "glXSwapBuffers");
      }
 
+   if (gpu_frame_timer)
+     {
+       gpu_frame_timer->frame_boundary(api_count);
+     }
+
    fptr(dpy, drawable);
 
    if (logger_app)
@@ -654,12 +1413,13 @@ glXSwapBuffers(void *dpy, GLXDrawable drawable)
          {
            frame_count = 0;
            logger_app->end_session(logger_app, logger_session);
-           logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize);
+           logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize, write_index, delta_keyframe_interval);
          }
      }
 
    ++frame_count;
    ++api_count;
+   Session::mark_frame(++total_frame_count);
 }
 
 extern "C"
@@ -695,6 +1455,11 @@ eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
        logger_app->pre_call(logger_app, api_count, "eglSwapBuffers", "eglSwapBuffers");
      }
 
+   if (gpu_frame_timer)
+     {
+       gpu_frame_timer->frame_boundary(api_count);
+     }
+
    R = fptr(dpy, surface);
 
    if (logger_app)
@@ -704,15 +1469,54 @@ eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
          {
            frame_count = 0;
            logger_app->end_session(logger_app, logger_session);
-           logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize);
+           logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize, write_index, delta_keyframe_interval);
          }
      }
 
    ++frame_count;
    ++api_count;
+   Session::mark_frame(++total_frame_count);
    return R;
 }
 
+extern "C"
+void
+glXDestroyContext(void *dpy, GLXContext ctx)
+{
+   typedef void (*fptr_type)(void*, GLXContext);
+   static fptr_type fptr = nullptr;
+
+   if (fptr == nullptr)
+     {
+       fptr = (fptr_type)gl_dlsym("glXDestroyContext");
+     }
+
+   if (gpu_frame_timer)
+     {
+       gpu_frame_timer->context_destroyed(ctx);
+     }
+   fptr(dpy, ctx);
+}
+
+extern "C"
+EGLBoolean
+eglDestroyContext(EGLDisplay dpy, EGLContext ctx)
+{
+   typedef EGLBoolean (*fptr_type)(EGLDisplay, EGLContext);
+   static fptr_type fptr = nullptr;
+
+   if (fptr == nullptr)
+     {
+       fptr = (fptr_type)egl_dlsym("eglDestroyContext");
+     }
+
+   if (gpu_frame_timer)
+     {
+       gpu_frame_timer->context_destroyed(ctx);
+     }
+   return fptr(dpy, ctx);
+}
+
 extern "C"
 void*
 glXGetProcAddress(const char *name)
@@ -804,8 +1608,28 @@ start_session(void)
                    most_recent_ioctl_max);
      }
    
+   gpu_frame_timing_ring_size =
+     read_from_environment<unsigned int>("I965_BLACKBOX_GPU_FRAME_TIMING", 0);
+   if (gpu_frame_timing_ring_size > 0)
+     {
+       std::printf("i965-blackbox: GPU frame timing ring size set to %u\n",
+                   gpu_frame_timing_ring_size);
+       gpu_frame_timer = new GpuFrameTimer(gpu_frame_timing_ring_size);
+     }
+
+   write_index = read_from_environment<bool>("I965_BLACKBOX_INDEX", true);
+
+   delta_keyframe_interval =
+     read_from_environment<unsigned int>("I965_BLACKBOX_DELTA_KEYFRAME_INTERVAL", 0);
+   if (delta_keyframe_interval > 0)
+     {
+       std::printf("i965-blackbox: delta encoding with a keyframe every %u records\n",
+                   delta_keyframe_interval);
+     }
+   
    logger_app = i965_batchbuffer_logger_app_acquire();
-   logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize);
+   logger_session = Session::start_session(most_recent_ioctl_max, logger_app, max_filesize, write_index, delta_keyframe_interval);
+   Session::mark_frame(total_frame_count);
 }
 
 __attribute__((destructor))
@@ -819,4 +1643,10 @@ end_session(void)
       logger_app->release_app(logger_app);
       logger_app = nullptr;
    }
+
+   /* the queries are not deleted since there may
+    * no longer be a current GL context.
+    */
+   delete gpu_frame_timer;
+   gpu_frame_timer = nullptr;
 }
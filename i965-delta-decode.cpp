@@ -0,0 +1,98 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "log_reader.hpp"
+#include "log_delta.hpp"
+
+/*
+ * Decodes a log file delta encoded by i965-blackbox.so (see
+ * log_delta.hpp) into the plain log file it would have been
+ * without encoding, so that it can be read by any tool that reads
+ * the logs. A file that is not delta encoded is copied as it is.
+ */
+
+namespace {
+
+void
+show_help(const char *app)
+{
+  std::printf("Usage: %s INPUT OUTPUT\n"
+              "Decode the delta encoded log file INPUT written by\n"
+              "i965-blackbox.so into the plain log file OUTPUT.\n"
+              "\n"
+              " --help     Display this help message and exit\n",
+              app);
+}
+
+} //anonymous namespace
+
+int
+main(int argc, char **argv)
+{
+  if (argc == 2 && (std::strcmp(argv[1], "-h") == 0
+                    || std::strcmp(argv[1], "--help") == 0))
+    {
+      show_help(argv[0]);
+      return 0;
+    }
+
+  if (argc != 3)
+    {
+      show_help(argv[0]);
+      return -1;
+    }
+
+  DeltaDecoder decoder(argv[1]);
+  if (!decoder.is_open())
+    {
+      std::fprintf(stderr, "Failed to open file %s\n", argv[1]);
+      return -1;
+    }
+
+  std::FILE *output;
+  output = std::fopen(argv[2], "wb");
+  if (!output)
+    {
+      std::fprintf(stderr, "Failed to open file %s\n", argv[2]);
+      return -1;
+    }
+
+  LogMessage msg;
+  while (decoder.read(&msg))
+    {
+      msg.write(output);
+    }
+  std::fclose(output);
+
+  if (decoder.num_lost_records() > 0)
+    {
+      std::fprintf(stderr, "%u delta encoded records could not be decoded\n",
+                   decoder.num_lost_records());
+      return -1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,963 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include "log_reader.hpp"
+#include "log_index.hpp"
+#include "log_delta.hpp"
+
+/*
+ * Extracts a range of frames or of execbuffer2 ioctls logged by
+ * i965-blackbox.so into a new self-contained log file. The log is
+ * given by its base name BASE (the value of I965_BLACKBOX_FILENAME):
+ * i965-blackbox.so starts a new session every so many frames, the
+ * files of session K being BASE-K.0, BASE-K.1, and so on, or just
+ * BASE.0, BASE.1, ... when only the most recent execbuffer2 ioctls
+ * are kept. Frames and ioctls are numbered across sessions, so the
+ * files of all sessions are read in order. A prefix BASE-K can be
+ * given instead of BASE to read only the files of session K.
+ *
+ * The index files written next to each log file (see log_index.hpp)
+ * give where each frame and ioctl starts and what blocks are open
+ * there, so only the bytes of the range are read. The new log file
+ * starts by restoring the blocks open at the start of the range in
+ * the same way Session::start_new_file() does, then is a copy of the
+ * bytes of the range and ends by closing the blocks open at the end
+ * of the range. An index file for the new log file is also written,
+ * with LOG_INDEX_OPEN and LOG_INDEX_CLOSE entries for the restored
+ * and closed blocks as the index of a log file of a single file
+ * session has.
+ *
+ * A range may span several files; the end of a file closes the
+ * blocks it has open and the next file restores the blocks open at
+ * its start. Where those are the blocks the previous file closed
+ * (as given by the LOG_INDEX_OPEN entry of the next file), they are
+ * kept open in the new log file, otherwise the closed blocks are
+ * ended and the restored ones begun, so copying across files keeps
+ * the block structure intact.
+ *
+ * A delta encoded log (see log_delta.hpp) is decoded from the keyframe
+ * before the start of the range as given by its index, and the new
+ * log file is not delta encoded.
+ */
+
+// size of the buffer used to copy a range of a log file
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+namespace {
+
+class LogFile
+{
+public:
+  std::string m_filename;
+  unsigned int m_session;
+  unsigned int m_number;
+
+  bool
+  operator<(const LogFile &rhs) const
+  {
+    return m_session < rhs.m_session
+      || (m_session == rhs.m_session && m_number < rhs.m_number);
+  }
+};
+
+/* Segment of a log file copied to the output */
+class Segment
+{
+public:
+  uint64_t m_src_begin, m_src_end;
+  uint64_t m_dst_begin;
+};
+
+/* A LogSource reads the messages of a log file at the offsets
+ * given by its index; for a delta encoded log file these are
+ * offsets in the log as decoded, and reading at an offset
+ * decodes from the keyframe before it.
+ */
+class LogSource
+{
+public:
+  explicit
+  LogSource(const std::string &filename):
+    m_decoder(filename.c_str())
+  {}
+
+  void
+  set_keyframes(const std::vector<LogIndexEntry> &entries);
+
+  bool
+  is_open(void) const
+  {
+    return m_decoder.is_open();
+  }
+
+  const std::string&
+  filename(void) const
+  {
+    return m_decoder.filename();
+  }
+
+  bool
+  is_encoded(void) const
+  {
+    return m_decoder.is_encoded();
+  }
+
+  uint64_t
+  offset(void) const
+  {
+    return m_decoder.offset();
+  }
+
+  bool
+  seek(uint64_t offset);
+
+  bool
+  read(LogMessage *msg)
+  {
+    return m_decoder.read(msg);
+  }
+
+private:
+  class Keyframe
+  {
+  public:
+    uint64_t m_offset;
+    uint64_t m_file_offset;
+  };
+
+  DeltaDecoder m_decoder;
+  std::vector<Keyframe> m_keyframes;
+};
+
+class Extractor
+{
+public:
+  Extractor(const std::string &kind, unsigned int first, unsigned int last):
+    m_kind(kind),
+    m_first(first),
+    m_last(last),
+    m_output(nullptr),
+    m_output_index(nullptr),
+    m_output_offset(0),
+    m_started(false),
+    m_done(false),
+    m_have_last_id(false),
+    m_last_id(0)
+  {}
+
+  ~Extractor()
+  {
+    if (m_output)
+      {
+        std::fclose(m_output);
+      }
+
+    if (m_output_index)
+      {
+        std::fclose(m_output_index);
+      }
+  }
+
+  bool
+  extract(const std::vector<LogFile> &files, const std::string &output);
+
+private:
+  bool
+  extract_range(const std::vector<LogFile> &files);
+
+  bool
+  process_file(const LogFile &file);
+
+  bool
+  write_prefix(LogSource &reader, const LogIndexEntry &start);
+
+  bool
+  restore_prefix(LogSource &reader, const LogIndexEntry &open);
+
+  bool
+  read_open_blocks(LogSource &reader, const LogIndexEntry &close);
+
+  bool
+  copy(LogSource &reader, const Segment &segment);
+
+  bool
+  map_offsets(const Segment &segment, LogIndexEntry *entry) const;
+
+  void
+  write_index(const std::vector<LogIndexEntry> &entries,
+              const Segment &segment);
+
+  void
+  write_index_entry(const char *kind, const std::vector<uint64_t> &block_offsets);
+
+  void
+  write_block_ends(size_t count);
+
+  std::string m_kind;
+  unsigned int m_first, m_last;
+
+  std::FILE *m_output;
+  std::FILE *m_output_index;
+  uint64_t m_output_offset;
+
+  bool m_started, m_done;
+
+  /* largest ID of m_kind found in the indices read */
+  bool m_have_last_id;
+  unsigned int m_last_id;
+
+  /* the offsets in the current file of the blocks open
+   * at the start of its segment and the offsets in the
+   * output of those blocks
+   */
+  std::vector<uint64_t> m_prefix_src_offsets;
+  std::vector<uint64_t> m_prefix_dst_offsets;
+
+  /* the blocks that were open when the previous file
+   * started to close them and their offsets in the
+   * output; the next file may continue them. Once the
+   * range is done, the offsets are those of the blocks
+   * open at its end.
+   */
+  std::vector<LogMessage> m_open_blocks;
+  std::vector<uint64_t> m_open_dst_offsets;
+};
+
+} //anonymous namespace
+
+/* Parse the digits of str starting at pos into *v,
+ * returns the number of characters parsed.
+ */
+static
+size_t
+parse_number(const std::string &str, size_t pos, unsigned int *v)
+{
+  size_t end;
+
+  end = str.find_first_not_of("0123456789", pos);
+  if (end == std::string::npos)
+    {
+      end = str.length();
+    }
+
+  if (end > pos)
+    {
+      *v = std::strtoul(str.substr(pos, end - pos).c_str(), nullptr, 10);
+    }
+  return end - pos;
+}
+
+/* Find the log files BASE-K.N and BASE.N, sorted by session K
+ * (taken as 0 for BASE.N) and then by N; the first files of a
+ * session made with I965_BLACKBOX_NUM_MOST_RECENT_KEEP are deleted,
+ * so the numbers need not start at 0.
+ */
+static
+std::vector<LogFile>
+find_session_files(const std::string &base)
+{
+  std::vector<LogFile> return_value;
+  std::string dirname(".");
+  std::string basename(base);
+  std::string::size_type slash;
+
+  slash = base.rfind('/');
+  if (slash != std::string::npos)
+    {
+      dirname = base.substr(0, slash + 1);
+      basename = base.substr(slash + 1);
+    }
+
+  DIR *dir = opendir(dirname.c_str());
+  if (!dir)
+    {
+      return return_value;
+    }
+
+  for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir))
+    {
+      std::string name(entry->d_name);
+      size_t pos(basename.length()), len;
+      LogFile file;
+
+      if (name.compare(0, basename.length(), basename) != 0)
+        {
+          continue;
+        }
+
+      file.m_session = 0;
+      if (pos < name.length() && name[pos] == '-')
+        {
+          len = parse_number(name, pos + 1, &file.m_session);
+          if (len == 0)
+            {
+              continue;
+            }
+          pos += len + 1;
+        }
+
+      if (pos >= name.length() || name[pos] != '.')
+        {
+          continue;
+        }
+
+      len = parse_number(name, pos + 1, &file.m_number);
+      if (len == 0 || pos + 1 + len != name.length())
+        {
+          continue;
+        }
+
+      file.m_filename = (slash != std::string::npos) ? dirname + name : name;
+      return_value.push_back(file);
+    }
+  closedir(dir);
+
+  std::sort(return_value.begin(), return_value.end());
+  return return_value;
+}
+
+//////////////////////////////////////////
+// LogSource methods
+void
+LogSource::
+set_keyframes(const std::vector<LogIndexEntry> &entries)
+{
+  m_keyframes.clear();
+  for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+      if (iter->m_kind == LOG_INDEX_KEYFRAME && iter->m_block_offsets.size() == 1)
+        {
+          Keyframe k;
+
+          k.m_offset = iter->m_offset;
+          k.m_file_offset = iter->m_block_offsets[0];
+          m_keyframes.push_back(k);
+        }
+    }
+}
+
+bool
+LogSource::
+seek(uint64_t offset)
+{
+  if (!m_decoder.is_encoded())
+    {
+      return m_decoder.seek(offset, offset);
+    }
+
+  Keyframe start;
+  LogMessage msg;
+
+  /* decoding can start at the start of the file or at a
+   * keyframe; the keyframes are in the order of the file.
+   */
+  start.m_offset = 0;
+  start.m_file_offset = 0;
+  for (auto iter = m_keyframes.begin(); iter != m_keyframes.end() && iter->m_offset <= offset; ++iter)
+    {
+      start = *iter;
+    }
+
+  if (m_decoder.offset() > offset || m_decoder.offset() < start.m_offset)
+    {
+      if (!m_decoder.seek(start.m_file_offset, start.m_offset))
+        {
+          return false;
+        }
+    }
+
+  while (m_decoder.offset() < offset)
+    {
+      if (!m_decoder.read(&msg))
+        {
+          return false;
+        }
+    }
+  return m_decoder.offset() == offset;
+}
+
+//////////////////////////////////////////
+// Extractor methods
+bool
+Extractor::
+write_prefix(LogSource &reader, const LogIndexEntry &start)
+{
+  LogMessage msg;
+
+  m_prefix_src_offsets.clear();
+  m_prefix_dst_offsets.clear();
+  for (auto iter = start.m_block_offsets.begin(); iter != start.m_block_offsets.end(); ++iter)
+    {
+      if (!reader.seek(*iter) || !reader.read(&msg)
+          || msg.m_type != I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN)
+        {
+          std::fprintf(stderr, "Bad block offset %" PRIu64 " in index of %s\n",
+                       *iter, reader.filename().c_str());
+          return false;
+        }
+
+      m_prefix_src_offsets.push_back(*iter);
+      m_prefix_dst_offsets.push_back(m_output_offset);
+      msg.write(m_output);
+      m_output_offset += msg.size();
+    }
+  return true;
+}
+
+bool
+Extractor::
+restore_prefix(LogSource &reader, const LogIndexEntry &open)
+{
+  std::vector<LogMessage> restored;
+  LogMessage msg;
+  size_t num_continued(0);
+
+  for (auto iter = open.m_block_offsets.begin(); iter != open.m_block_offsets.end(); ++iter)
+    {
+      if (!reader.seek(*iter) || !reader.read(&msg)
+          || msg.m_type != I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN)
+        {
+          std::fprintf(stderr, "Bad block offset %" PRIu64 " in index of %s\n",
+                       *iter, reader.filename().c_str());
+          return false;
+        }
+      restored.push_back(msg);
+    }
+
+  /* the restored blocks that continue the blocks the previous
+   * file closed stay open in the output, the other closed
+   * blocks are ended and the other restored blocks begun.
+   */
+  while (num_continued < open.m_id
+         && num_continued < restored.size()
+         && num_continued < m_open_blocks.size()
+         && restored[num_continued].m_name == m_open_blocks[num_continued].m_name
+         && restored[num_continued].m_value == m_open_blocks[num_continued].m_value)
+    {
+      ++num_continued;
+    }
+  write_block_ends(m_open_blocks.size() - num_continued);
+
+  m_prefix_src_offsets = open.m_block_offsets;
+  m_prefix_dst_offsets.assign(m_open_dst_offsets.begin(),
+                              m_open_dst_offsets.begin() + num_continued);
+  for (size_t i = num_continued; i < restored.size(); ++i)
+    {
+      m_prefix_dst_offsets.push_back(m_output_offset);
+      restored[i].write(m_output);
+      m_output_offset += restored[i].size();
+    }
+  return true;
+}
+
+bool
+Extractor::
+read_open_blocks(LogSource &reader, const LogIndexEntry &close)
+{
+  LogMessage msg;
+
+  m_open_blocks.clear();
+  for (auto iter = close.m_block_offsets.begin(); iter != close.m_block_offsets.end(); ++iter)
+    {
+      if (!reader.seek(*iter) || !reader.read(&msg)
+          || msg.m_type != I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN)
+        {
+          std::fprintf(stderr, "Bad block offset %" PRIu64 " in index of %s\n",
+                       *iter, reader.filename().c_str());
+          return false;
+        }
+      m_open_blocks.push_back(msg);
+    }
+  return true;
+}
+
+bool
+Extractor::
+copy(LogSource &reader, const Segment &segment)
+{
+  if (reader.is_encoded())
+    {
+      LogMessage msg;
+
+      if (!reader.seek(segment.m_src_begin))
+        {
+          std::fprintf(stderr, "Failed to decode file %s at offset %" PRIu64 "\n",
+                       reader.filename().c_str(), segment.m_src_begin);
+          return false;
+        }
+
+      while (reader.offset() < segment.m_src_end && reader.read(&msg))
+        {
+          msg.write(m_output);
+          m_output_offset += msg.size();
+        }
+      return true;
+    }
+
+  const std::string &filename(reader.filename());
+  std::vector<char> buffer(COPY_BUFFER_SIZE);
+  std::FILE *file;
+  uint64_t remaining;
+
+  file = std::fopen(filename.c_str(), "rb");
+  if (!file || fseeko(file, segment.m_src_begin, SEEK_SET) != 0)
+    {
+      std::fprintf(stderr, "Failed to seek in file %s\n", filename.c_str());
+      if (file)
+        {
+          std::fclose(file);
+        }
+      return false;
+    }
+
+  remaining = segment.m_src_end - segment.m_src_begin;
+  while (remaining > 0)
+    {
+      size_t sz, rd;
+
+      sz = std::min(remaining, static_cast<uint64_t>(buffer.size()));
+      rd = std::fread(&buffer[0], sizeof(char), sz, file);
+      if (rd == 0)
+        {
+          break;
+        }
+      std::fwrite(&buffer[0], sizeof(char), rd, m_output);
+      m_output_offset += rd;
+      remaining -= rd;
+    }
+  std::fclose(file);
+  return true;
+}
+
+bool
+Extractor::
+map_offsets(const Segment &segment, LogIndexEntry *entry) const
+{
+  entry->m_offset = entry->m_offset - segment.m_src_begin + segment.m_dst_begin;
+  for (uint64_t &offset : entry->m_block_offsets)
+    {
+      if (offset >= segment.m_src_begin)
+        {
+          offset = offset - segment.m_src_begin + segment.m_dst_begin;
+        }
+      else
+        {
+          /* a block opened before the segment is one
+           * of the blocks open at its start
+           */
+          auto p = std::find(m_prefix_src_offsets.begin(),
+                             m_prefix_src_offsets.end(), offset);
+          if (p == m_prefix_src_offsets.end())
+            {
+              return false;
+            }
+          offset = m_prefix_dst_offsets[p - m_prefix_src_offsets.begin()];
+        }
+    }
+  return true;
+}
+
+void
+Extractor::
+write_index(const std::vector<LogIndexEntry> &entries,
+            const Segment &segment)
+{
+  for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+    {
+      if (iter->m_kind == LOG_INDEX_CLOSE
+          || iter->m_kind == LOG_INDEX_OPEN
+          || iter->m_kind == LOG_INDEX_KEYFRAME
+          || iter->m_offset < segment.m_src_begin
+          || iter->m_offset >= segment.m_src_end)
+        {
+          continue;
+        }
+
+      LogIndexEntry entry(*iter);
+      if (map_offsets(segment, &entry))
+        {
+          entry.write(m_output_index);
+        }
+    }
+}
+
+/* Write an entry of kind for the current offset of the output;
+ * as the output is a single file with nothing before it, the
+ * ID of both its LOG_INDEX_OPEN and LOG_INDEX_CLOSE entries is 0.
+ */
+void
+Extractor::
+write_index_entry(const char *kind, const std::vector<uint64_t> &block_offsets)
+{
+  LogIndexEntry entry;
+
+  entry.m_kind = kind;
+  entry.m_id = 0;
+  entry.m_offset = m_output_offset;
+  entry.m_block_offsets = block_offsets;
+  entry.write(m_output_index);
+}
+
+void
+Extractor::
+write_block_ends(size_t count)
+{
+  LogMessage msg;
+
+  msg.m_type = I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_END;
+  for (size_t i = 0; i < count; ++i)
+    {
+      msg.write(m_output);
+      m_output_offset += msg.size();
+    }
+}
+
+bool
+Extractor::
+process_file(const LogFile &file)
+{
+  std::vector<LogIndexEntry> entries;
+  std::FILE *index_file;
+  LogSource reader(file.m_filename);
+  Segment segment;
+  const LogIndexEntry *end(nullptr), *close(nullptr), *open(nullptr);
+
+  index_file = std::fopen(log_index_filename(file.m_filename).c_str(), "r");
+  if (!index_file)
+    {
+      std::fprintf(stderr, "No index file for %s, was it logged with "
+                   "I965_BLACKBOX_INDEX=0?\n", file.m_filename.c_str());
+      return false;
+    }
+
+  LogIndexEntry entry;
+  while (entry.read(index_file))
+    {
+      entries.push_back(entry);
+      if (entry.m_kind == m_kind
+          && (!m_have_last_id || entry.m_id > m_last_id))
+        {
+          m_have_last_id = true;
+          m_last_id = entry.m_id;
+        }
+    }
+  std::fclose(index_file);
+
+  for (auto iter = entries.begin(); iter != entries.end() && !open; ++iter)
+    {
+      if (iter->m_kind == LOG_INDEX_OPEN)
+        {
+          open = &*iter;
+        }
+    }
+
+  if (!reader.is_open())
+    {
+      std::fprintf(stderr, "Failed to open file %s\n", file.m_filename.c_str());
+      return false;
+    }
+  reader.set_keyframes(entries);
+
+  if (!m_started)
+    {
+      const LogIndexEntry *start(nullptr);
+
+      for (auto iter = entries.begin(); iter != entries.end() && !start; ++iter)
+        {
+          if (iter->m_kind == m_kind && iter->m_id >= m_first && iter->m_id <= m_last)
+            {
+              start = &*iter;
+            }
+        }
+
+      if (!start)
+        {
+          return true;
+        }
+
+      std::printf("Start of range at offset %" PRIu64 " of %s\n",
+                  start->m_offset, file.m_filename.c_str());
+      m_started = true;
+      segment.m_src_begin = start->m_offset;
+      if (!write_prefix(reader, *start))
+        {
+          return false;
+        }
+      write_index_entry(LOG_INDEX_OPEN, m_prefix_dst_offsets);
+    }
+  else
+    {
+      segment.m_src_begin = open ? open->m_offset : 0;
+      for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+          /* the range ended with the previous file */
+          if (iter->m_kind == m_kind && iter->m_id > m_last
+              && iter->m_offset <= segment.m_src_begin)
+            {
+              m_open_blocks.clear();
+              m_done = true;
+              return true;
+            }
+        }
+
+      if (open)
+        {
+          if (!restore_prefix(reader, *open))
+            {
+              return false;
+            }
+        }
+      else
+        {
+          /* without an open entry, the file is taken
+           * to not continue the previous one.
+           */
+          write_block_ends(m_open_blocks.size());
+          m_prefix_src_offsets.clear();
+          m_prefix_dst_offsets.clear();
+        }
+    }
+
+  for (auto iter = entries.begin(); iter != entries.end() && !end; ++iter)
+    {
+      if (iter->m_kind == m_kind && iter->m_id > m_last
+          && iter->m_offset >= segment.m_src_begin)
+        {
+          end = &*iter;
+        }
+      else if (iter->m_kind == LOG_INDEX_CLOSE)
+        {
+          close = &*iter;
+        }
+    }
+
+  if (end)
+    {
+      segment.m_src_end = end->m_offset;
+      std::printf("End of range at offset %" PRIu64 " of %s\n",
+                  end->m_offset, file.m_filename.c_str());
+    }
+  else if (close)
+    {
+      segment.m_src_end = close->m_offset;
+    }
+  else
+    {
+      /* without a close entry (for example from a crash),
+       * the file is copied to its end.
+       */
+      segment.m_src_end = UINT64_MAX;
+    }
+
+  segment.m_dst_begin = m_output_offset;
+  if (!copy(reader, segment))
+    {
+      return false;
+    }
+  write_index(entries, segment);
+
+  m_open_blocks.clear();
+  m_open_dst_offsets.clear();
+  if (end)
+    {
+      LogIndexEntry open_blocks(*end);
+
+      if (!map_offsets(segment, &open_blocks))
+        {
+          std::fprintf(stderr, "Bad block offsets in index of %s\n",
+                       file.m_filename.c_str());
+          return false;
+        }
+      m_open_dst_offsets = open_blocks.m_block_offsets;
+      m_done = true;
+    }
+  else if (close)
+    {
+      LogIndexEntry open_blocks(*close);
+
+      if (!map_offsets(segment, &open_blocks))
+        {
+          std::fprintf(stderr, "Bad block offsets in index of %s\n",
+                       file.m_filename.c_str());
+          return false;
+        }
+
+      if (!read_open_blocks(reader, *close))
+        {
+          return false;
+        }
+      m_open_dst_offsets = open_blocks.m_block_offsets;
+    }
+
+  return true;
+}
+
+bool
+Extractor::
+extract_range(const std::vector<LogFile> &files)
+{
+  for (auto iter = files.begin(); iter != files.end() && !m_done; ++iter)
+    {
+      if (!process_file(*iter))
+        {
+          return false;
+        }
+    }
+
+  if (!m_started)
+    {
+      std::fprintf(stderr, "No %s in range [%u, %u] found\n",
+                   m_kind.c_str(), m_first, m_last);
+      return false;
+    }
+
+  if (!m_done && m_last_id < m_last)
+    {
+      std::fprintf(stderr, "Range [%u, %u] goes past the last %s logged, %u\n",
+                   m_first, m_last, m_kind.c_str(), m_last_id);
+      return false;
+    }
+
+  /* close the blocks open where the range ends */
+  write_index_entry(LOG_INDEX_CLOSE, m_open_dst_offsets);
+  write_block_ends(m_open_dst_offsets.size());
+  return true;
+}
+
+bool
+Extractor::
+extract(const std::vector<LogFile> &files, const std::string &output)
+{
+  std::string output_index(log_index_filename(output));
+  bool return_value(false);
+
+  m_output = std::fopen(output.c_str(), "wb");
+  m_output_index = std::fopen(output_index.c_str(), "w");
+  if (!m_output || !m_output_index)
+    {
+      std::fprintf(stderr, "Failed to open file %s\n", output.c_str());
+    }
+  else
+    {
+      return_value = extract_range(files);
+    }
+
+  if (return_value)
+    {
+      std::printf("Wrote %" PRIu64 " bytes to %s\n", m_output_offset, output.c_str());
+      return true;
+    }
+
+  /* do not leave a partial extract behind */
+  if (m_output)
+    {
+      std::fclose(m_output);
+      m_output = nullptr;
+      std::remove(output.c_str());
+    }
+
+  if (m_output_index)
+    {
+      std::fclose(m_output_index);
+      m_output_index = nullptr;
+      std::remove(output_index.c_str());
+    }
+  return false;
+}
+
+static
+void
+show_help(const char *app)
+{
+  std::printf("Usage: %s [OPTION]... BASE OUTPUT\n"
+              "Extract a range of frames or execbuffer2 ioctls logged by\n"
+              "i965-blackbox.so to the files BASE-K.N of all sessions K (or\n"
+              "BASE.N) into the self-contained log file OUTPUT; BASE is the value\n"
+              "of I965_BLACKBOX_FILENAME. The log must have been made with its\n"
+              "index files (the default).\n"
+              "\n"
+              " -frames FIRST LAST  Extract the frames FIRST to LAST inclusive\n"
+              "\n"
+              " -ioctls FIRST LAST  Extract the execbuffer2 ioctls with ID FIRST\n"
+              "                     to LAST inclusive\n"
+              "\n"
+              " --help     Display this help message and exit\n",
+              app);
+}
+
+int
+main(int argc, char **argv)
+{
+  std::string kind;
+  unsigned int first = 0, last = 0;
+  int start;
+
+  for (start = 1; start < argc; ++start)
+    {
+      if ((std::strcmp(argv[start], "-frames") == 0
+           || std::strcmp(argv[start], "-ioctls") == 0)
+          && start + 2 < argc)
+        {
+          kind = (argv[start][1] == 'f') ? LOG_INDEX_FRAME : LOG_INDEX_IOCTL;
+          first = std::strtoul(argv[start + 1], nullptr, 10);
+          last = std::strtoul(argv[start + 2], nullptr, 10);
+          start += 2;
+        }
+      else if (std::strcmp(argv[start], "-h") == 0
+               || std::strcmp(argv[start], "--help") == 0)
+        {
+          show_help(argv[0]);
+          return 0;
+        }
+      else
+        {
+          break;
+        }
+    }
+
+  if (kind.empty() || start + 2 != argc || first > last)
+    {
+      show_help(argv[0]);
+      return -1;
+    }
+
+  std::vector<LogFile> files;
+  files = find_session_files(argv[start]);
+  if (files.empty())
+    {
+      std::fprintf(stderr, "No log files with base name %s\n", argv[start]);
+      return -1;
+    }
+
+  Extractor extractor(kind, first, last);
+  return extractor.extract(files, argv[start + 1]) ? 0 : -1;
+}
@@ -0,0 +1,637 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <inttypes.h>
+#include "log_reader.hpp"
+#include "log_delta.hpp"
+
+/*
+ * Reads one or more log files made by i965-blackbox.so and writes
+ * the block structure as folded stacks, i.e. one line per unique
+ * stack of the form
+ *
+ *   block0;block1;...;blockN weight
+ *
+ * which is the input format of the standard flame-graph tools.
+ * Each stack is made from the names of the blocks (frame, API call,
+ * execbuffer2, batchbuffer, GPU command, ...) enclosing a GPU
+ * command and ending with the GPU command. A GPU command is a block
+ * that is not within another GPU command and that either is directly
+ * within a container block, i.e. a block whose name contains one of
+ * the CONTAINER_NAMES (such as execbuffer2 or batchbuffer), or has a
+ * value named by LENGTH_FIELD_NAME. In particular the blocks of API
+ * calls that sent no GPU commands and the blocks of the structures
+ * decoded within a GPU command are not GPU commands. If -depth is
+ * given, stacks are cut at that depth so that the weight of deeper
+ * GPU commands is given to their enclosing block at that depth.
+ *
+ * The weight of a GPU command is one of:
+ *  - count : 1 for each command
+ *  - dwords: the number of dwords of the command, taken from the
+ *            value of the field named by LENGTH_FIELD_NAME plus
+ *            LENGTH_FIELD_BIAS; the field is only present in the
+ *            log if it was made with instruction_details_decode,
+ *            commands without it are weighted 0 and reported
+ *  - bytes : 4 times the dwords weight
+ *
+ * The files are streamed one message at a time and the stacks are
+ * accumulated across all files, so that an entire capture split
+ * across many files gives a single profile. The files of a session
+ * must be given in order so that a block split across two files
+ * is seen as one block.
+ */
+
+// name of the field of a GPU command giving its length
+#define LENGTH_FIELD_NAME "DWord Length"
+
+// the number of dwords of a GPU command is its length field plus this
+#define LENGTH_FIELD_BIAS 2
+
+/* a block whose name contains one of these, ignoring case, holds
+ * GPU commands; the list ends with nullptr.
+ */
+#define CONTAINER_NAMES { "execbuffer", "batchbuffer", nullptr }
+
+namespace {
+
+enum weight_mode_t
+  {
+    weight_count,
+    weight_dwords,
+    weight_bytes,
+  };
+
+class StackEntry
+{
+public:
+  explicit
+  StackEntry(const std::string &frame):
+    m_frame(frame),
+    m_container(false),
+    m_command(false),
+    m_has_length(false),
+    m_length(0)
+  {}
+
+  std::string m_frame;
+  bool m_container;
+  bool m_command;
+  bool m_has_length;
+  uint64_t m_length;
+};
+
+class FoldedStacks
+{
+public:
+  FoldedStacks(enum weight_mode_t mode, unsigned int max_depth,
+               bool with_values):
+    m_mode(mode),
+    m_max_depth(max_depth),
+    m_with_values(with_values),
+    m_num_commands(0),
+    m_num_commands_without_length(0),
+    m_pending_ends(0),
+    m_resuming(false),
+    m_num_resumed(0)
+  {}
+
+  bool
+  process_file(const char *filename);
+
+  /* to be called after the last file is processed */
+  void
+  finish(void);
+
+  void
+  write(std::FILE *file) const;
+
+  uint64_t
+  num_commands(void) const
+  {
+    return m_num_commands;
+  }
+
+  uint64_t
+  num_commands_without_length(void) const
+  {
+    return m_num_commands_without_length;
+  }
+
+private:
+  void
+  process_message(const LogMessage &msg);
+
+  void
+  flush_pending_ends(void);
+
+  void
+  end_resume(void);
+
+  std::string
+  frame_name(const LogMessage &msg) const;
+
+  bool
+  within_command(size_t depth) const;
+
+  void
+  begin_block(const LogMessage &msg);
+
+  void
+  end_block(void);
+
+  void
+  value(const LogMessage &msg);
+
+  static
+  std::string
+  sanitize(const std::string &str);
+
+  static
+  bool
+  is_container_name(const std::string &name);
+
+  enum weight_mode_t m_mode;
+  unsigned int m_max_depth;
+  bool m_with_values;
+
+  std::vector<StackEntry> m_stack;
+  std::map<std::string, uint64_t> m_weights;
+  uint64_t m_num_commands;
+  uint64_t m_num_commands_without_length;
+
+  /* Session::close_file() ends a file by closing the open blocks
+   * and Session::start_new_file() restores them at the start of
+   * the next file. A block split that way must not be seen as two
+   * blocks, so BLOCK_END messages are held back in m_pending_ends
+   * until a message that is not a BLOCK_END comes. If the end of a
+   * file closes all open blocks, the stack is kept and the blocks
+   * restored at the start of the next file (counted by m_num_resumed)
+   * continue them.
+   */
+  unsigned int m_pending_ends;
+  bool m_resuming;
+  size_t m_num_resumed;
+};
+
+} //anonymous namespace
+
+//////////////////////////////////////////
+// FoldedStacks methods
+std::string
+FoldedStacks::
+sanitize(const std::string &str)
+{
+  std::string return_value(str);
+
+  /* ';' separates frames and a newline separates stacks;
+   * a trailing NUL is common in names and values.
+   */
+  while (!return_value.empty() && return_value.back() == '\0')
+    {
+      return_value.pop_back();
+    }
+
+  for (char &c : return_value)
+    {
+      if (c == ';')
+        {
+          c = ':';
+        }
+      else if (c == '\n' || c == '\r' || c == '\t' || c == '\0')
+        {
+          c = ' ';
+        }
+    }
+  return return_value;
+}
+
+std::string
+FoldedStacks::
+frame_name(const LogMessage &msg) const
+{
+  std::string return_value(sanitize(msg.m_name));
+
+  if (m_with_values && !msg.m_value.empty())
+    {
+      return_value += " " + sanitize(msg.m_value);
+    }
+  return return_value;
+}
+
+bool
+FoldedStacks::
+is_container_name(const std::string &name)
+{
+  static const char *names[] = CONTAINER_NAMES;
+  std::string lower(name);
+
+  for (char &c : lower)
+    {
+      c = std::tolower(static_cast<unsigned char>(c));
+    }
+
+  for (const char **p = names; *p; ++p)
+    {
+      if (lower.find(*p) != std::string::npos)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+/* true if one of the first depth blocks of the stack is a GPU command */
+bool
+FoldedStacks::
+within_command(size_t depth) const
+{
+  for (size_t i = 0; i < depth; ++i)
+    {
+      if (m_stack[i].m_command)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+FoldedStacks::
+begin_block(const LogMessage &msg)
+{
+  StackEntry entry(frame_name(msg));
+
+  entry.m_container = is_container_name(msg.m_name);
+  entry.m_command = !entry.m_container
+    && !m_stack.empty() && m_stack.back().m_container;
+  m_stack.push_back(entry);
+}
+
+void
+FoldedStacks::
+end_block(void)
+{
+  if (m_stack.empty())
+    {
+      return;
+    }
+
+  if (!m_stack.back().m_command || within_command(m_stack.size() - 1))
+    {
+      m_stack.pop_back();
+      return;
+    }
+
+  const StackEntry &cmd(m_stack.back());
+  uint64_t weight;
+
+  ++m_num_commands;
+  switch (m_mode)
+    {
+    default:
+    case weight_count:
+      weight = 1;
+      break;
+
+    case weight_dwords:
+    case weight_bytes:
+      if (cmd.m_has_length)
+        {
+          weight = cmd.m_length + LENGTH_FIELD_BIAS;
+          if (m_mode == weight_bytes)
+            {
+              weight *= 4;
+            }
+        }
+      else
+        {
+          weight = 0;
+          ++m_num_commands_without_length;
+        }
+      break;
+    }
+
+  if (weight > 0)
+    {
+      std::string stack;
+      size_t depth(m_stack.size());
+
+      if (m_max_depth > 0 && depth > m_max_depth)
+        {
+          depth = m_max_depth;
+        }
+
+      for (size_t i = 0; i < depth; ++i)
+        {
+          if (i != 0)
+            {
+              stack += ";";
+            }
+          stack += m_stack[i].m_frame;
+        }
+      m_weights[stack] += weight;
+    }
+  m_stack.pop_back();
+}
+
+void
+FoldedStacks::
+value(const LogMessage &msg)
+{
+  if (m_stack.empty() || m_stack.back().m_has_length
+      || m_stack.back().m_container)
+    {
+      return;
+    }
+
+  if (sanitize(msg.m_name) == LENGTH_FIELD_NAME)
+    {
+      m_stack.back().m_command = true;
+      m_stack.back().m_has_length = true;
+      m_stack.back().m_length = std::strtoull(msg.m_value.c_str(), nullptr, 0);
+    }
+}
+
+bool
+FoldedStacks::
+process_file(const char *filename)
+{
+  DeltaDecoder reader(filename);
+  LogMessage msg;
+
+  if (!reader.is_open())
+    {
+      std::fprintf(stderr, "Failed to open file %s\n", filename);
+      return false;
+    }
+
+  while (reader.read(&msg))
+    {
+      process_message(msg);
+    }
+
+  if (reader.num_lost_records() > 0)
+    {
+      std::fprintf(stderr, "%s: %u delta encoded records could not be decoded\n",
+                   filename, reader.num_lost_records());
+    }
+
+  if (!m_stack.empty() && m_pending_ends == m_stack.size())
+    {
+      m_pending_ends = 0;
+      m_resuming = true;
+      m_num_resumed = 0;
+    }
+  else
+    {
+      /* a file always closes the blocks it has open, but a
+       * truncated file (for example from a crash) might not.
+       */
+      flush_pending_ends();
+      m_stack.clear();
+    }
+  return true;
+}
+
+void
+FoldedStacks::
+finish(void)
+{
+  if (m_resuming)
+    {
+      m_num_resumed = 0;
+      end_resume();
+    }
+  flush_pending_ends();
+  m_stack.clear();
+}
+
+void
+FoldedStacks::
+process_message(const LogMessage &msg)
+{
+  if (m_resuming)
+    {
+      if (msg.m_type == I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN
+          && m_num_resumed < m_stack.size()
+          && frame_name(msg) == m_stack[m_num_resumed].m_frame)
+        {
+          ++m_num_resumed;
+          return;
+        }
+      end_resume();
+    }
+
+  if (msg.m_type == I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_END)
+    {
+      ++m_pending_ends;
+      return;
+    }
+
+  flush_pending_ends();
+  switch (msg.m_type)
+    {
+    case I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN:
+      begin_block(msg);
+      break;
+
+    case I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE:
+      value(msg);
+      break;
+
+    default:
+      break;
+    }
+}
+
+void
+FoldedStacks::
+flush_pending_ends(void)
+{
+  for (; m_pending_ends > 0; --m_pending_ends)
+    {
+      end_block();
+    }
+}
+
+void
+FoldedStacks::
+end_resume(void)
+{
+  /* the blocks that were not restored really ended
+   * at the end of the previous file.
+   */
+  m_resuming = false;
+  while (m_stack.size() > m_num_resumed)
+    {
+      end_block();
+    }
+}
+
+void
+FoldedStacks::
+write(std::FILE *file) const
+{
+  for (auto iter = m_weights.begin(); iter != m_weights.end(); ++iter)
+    {
+      std::fprintf(file, "%s %" PRIu64 "\n", iter->first.c_str(), iter->second);
+    }
+}
+
+static
+void
+show_help(const char *app)
+{
+  std::printf("Usage: %s [OPTION]... FILE...\n"
+              "Write the GPU commands of the i965-blackbox log files FILE...\n"
+              "as folded stacks, to be used with flame-graph tools.\n"
+              "\n"
+              " -weight W  Weight each GPU command by W, one of\n"
+              "              count : the number of commands (default)\n"
+              "              dwords: the number of dwords of commands\n"
+              "              bytes : the number of bytes of commands\n"
+              "            dwords and bytes require the log to be made\n"
+              "            with instruction_details_decode\n"
+              "\n"
+              " -depth N   Cut stacks at depth N, giving the weight of\n"
+              "            deeper GPU commands to their enclosing block at\n"
+              "            depth N (default 0, do not cut stacks)\n"
+              "\n"
+              " -with-values  Name each frame by the name and value of its\n"
+              "               block instead of just the name\n"
+              "\n"
+              " -o FILE    Write the folded stacks to FILE instead of stdout\n"
+              "\n"
+              " --help     Display this help message and exit\n",
+              app);
+}
+
+int
+main(int argc, char **argv)
+{
+  enum weight_mode_t mode = weight_count;
+  unsigned int max_depth = 0;
+  bool with_values = false;
+  const char *output = nullptr;
+  int start;
+
+  for (start = 1; start < argc; ++start)
+    {
+      if (std::strcmp(argv[start], "-weight") == 0 && start + 1 < argc)
+        {
+          ++start;
+          if (std::strcmp(argv[start], "count") == 0)
+            {
+              mode = weight_count;
+            }
+          else if (std::strcmp(argv[start], "dwords") == 0)
+            {
+              mode = weight_dwords;
+            }
+          else if (std::strcmp(argv[start], "bytes") == 0)
+            {
+              mode = weight_bytes;
+            }
+          else
+            {
+              std::fprintf(stderr, "Unknown weight \"%s\"\n", argv[start]);
+              return -1;
+            }
+        }
+      else if (std::strcmp(argv[start], "-depth") == 0 && start + 1 < argc)
+        {
+          max_depth = std::strtoul(argv[++start], nullptr, 10);
+        }
+      else if (std::strcmp(argv[start], "-with-values") == 0)
+        {
+          with_values = true;
+        }
+      else if (std::strcmp(argv[start], "-o") == 0 && start + 1 < argc)
+        {
+          output = argv[++start];
+        }
+      else if (std::strcmp(argv[start], "-h") == 0
+               || std::strcmp(argv[start], "--help") == 0)
+        {
+          show_help(argv[0]);
+          return 0;
+        }
+      else if (std::strcmp(argv[start], "--") == 0)
+        {
+          ++start;
+          break;
+        }
+      else
+        {
+          break;
+        }
+    }
+
+  if (start >= argc)
+    {
+      show_help(argv[0]);
+      return -1;
+    }
+
+  FoldedStacks stacks(mode, max_depth, with_values);
+  for (int i = start; i < argc; ++i)
+    {
+      stacks.process_file(argv[i]);
+    }
+  stacks.finish();
+
+  std::FILE *file = stdout;
+  if (output)
+    {
+      file = std::fopen(output, "w");
+      if (!file)
+        {
+          std::fprintf(stderr, "Failed to open file %s\n", output);
+          return -1;
+        }
+    }
+
+  stacks.write(file);
+  if (file != stdout)
+    {
+      std::fclose(file);
+    }
+
+  if (stacks.num_commands_without_length() > 0)
+    {
+      std::fprintf(stderr, "%" PRIu64 " of %" PRIu64 " GPU commands have no \""
+                   LENGTH_FIELD_NAME "\" field and were given weight 0\n",
+                   stacks.num_commands_without_length(),
+                   stacks.num_commands());
+    }
+
+  return 0;
+}
@@ -0,0 +1,442 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <sstream>
+#include <stdint.h>
+
+#include "log_reader.hpp"
+
+/* A delta encoded log file is a log file that starts with a value
+ * message named DELTA_ENCODING_MESSAGE. The messages of an
+ * execbuffer2 ioctl (from its pre to its post hook) form a record,
+ * as do the messages between two ioctls; a record is written as
+ * one of the following:
+ *
+ *  - a value message named DELTA_KEYFRAME_MESSAGE whose value is
+ *    the number N of messages of the record, followed by those N
+ *    messages. A keyframe starts a new chain of deltas: no record
+ *    after a keyframe refers to a record before it.
+ *
+ *  - a value message named DELTA_RECORD_MESSAGE whose value is the
+ *    number N of messages of the record, followed by those N
+ *    messages.
+ *
+ *  - a value message named DELTA_DELTA_MESSAGE whose value is
+ *    "SIGNATURE N C" followed by C value messages. The record is
+ *    the most recent record with the same signature, which has N
+ *    messages, where the value of the message at index given by
+ *    the name of each of the C value messages is changed to the
+ *    value of that value message.
+ *
+ * The signature of a record is a hash of the type and name of each
+ * of its messages, so two records with the same signature usually
+ * differ only in values (for example addresses and constants).
+ * Messages that are not within a record (for example the blocks
+ * restored at the start of a file) are written as they are.
+ *
+ * Decoding can start at the start of the file or at any keyframe;
+ * the index file of a delta encoded log file (see log_index.hpp)
+ * gives where the keyframes are.
+ */
+#define DELTA_ENCODING_MESSAGE "i965-blackbox-encoding"
+#define DELTA_KEYFRAME_MESSAGE "i965-blackbox-keyframe"
+#define DELTA_RECORD_MESSAGE "i965-blackbox-record"
+#define DELTA_DELTA_MESSAGE "i965-blackbox-delta"
+
+// maximum number of records that deltas may refer to
+#define DELTA_MAX_REFERENCES 64
+
+namespace
+{
+  typedef std::vector<LogMessage> LogRecord;
+
+  /* FNV-1a hash of the type and name of each message */
+  uint64_t
+  record_signature(const LogRecord &record)
+  {
+    uint64_t hash(14695981039346656037ull);
+
+    for (auto iter = record.begin(); iter != record.end(); ++iter)
+      {
+        hash = (hash ^ static_cast<uint8_t>(iter->m_type)) * 1099511628211ull;
+        for (char c : iter->m_name)
+          {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+          }
+        hash = (hash ^ 0xff) * 1099511628211ull;
+      }
+    return hash;
+  }
+
+  bool
+  same_structure(const LogRecord &a, const LogRecord &b)
+  {
+    if (a.size() != b.size())
+      {
+        return false;
+      }
+
+    for (size_t i = 0; i < a.size(); ++i)
+      {
+        if (a[i].m_type != b[i].m_type || a[i].m_name != b[i].m_name)
+          {
+            return false;
+          }
+      }
+    return true;
+  }
+
+  LogMessage
+  delta_marker(const char *name, const std::string &value)
+  {
+    LogMessage return_value;
+
+    return_value.m_type = I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE;
+    return_value.m_name = name;
+    return_value.m_value = value;
+    return return_value;
+  }
+
+  /* The records a delta may refer to: the most recent record of
+   * each signature since the last keyframe, at most
+   * DELTA_MAX_REFERENCES of them. The encoder and the decoder
+   * make the same calls so they always hold the same records.
+   */
+  class DeltaReferences
+  {
+  public:
+    const LogRecord*
+    find(uint64_t signature) const
+    {
+      auto iter = m_records.find(signature);
+      return (iter != m_records.end()) ? &iter->second : nullptr;
+    }
+
+    void
+    add(uint64_t signature, const LogRecord &record)
+    {
+      if (m_records.find(signature) != m_records.end())
+        {
+          m_order.remove(signature);
+        }
+      else if (m_records.size() >= DELTA_MAX_REFERENCES)
+        {
+          m_records.erase(m_order.front());
+          m_order.pop_front();
+        }
+      m_records[signature] = record;
+      m_order.push_back(signature);
+    }
+
+    void
+    clear(void)
+    {
+      m_records.clear();
+      m_order.clear();
+    }
+
+  private:
+    std::map<uint64_t, LogRecord> m_records;
+    std::list<uint64_t> m_order;
+  };
+
+  class DeltaEncoder
+  {
+  public:
+    /* keyframe_interval is the number of records from
+     * one keyframe to the next, 0 means no encoding.
+     */
+    explicit
+    DeltaEncoder(unsigned int keyframe_interval):
+      m_keyframe_interval(keyframe_interval),
+      m_num_since_keyframe(0)
+    {}
+
+    bool
+    enabled(void) const
+    {
+      return m_keyframe_interval > 0;
+    }
+
+    /* to be called at the start of each file, so that
+     * each file can be decoded on its own.
+     */
+    void
+    begin_file(LogRecord *out)
+    {
+      m_num_since_keyframe = m_keyframe_interval;
+      out->push_back(delta_marker(DELTA_ENCODING_MESSAGE, "1"));
+    }
+
+    /* returns true if the record is written as a keyframe */
+    bool
+    encode(const LogRecord &record, LogRecord *out)
+    {
+      uint64_t signature(record_signature(record));
+      const LogRecord *ref(nullptr);
+      std::ostringstream str;
+
+      if (m_num_since_keyframe >= m_keyframe_interval)
+        {
+          m_num_since_keyframe = 0;
+          m_references.clear();
+          str << record.size();
+          out->push_back(delta_marker(DELTA_KEYFRAME_MESSAGE, str.str()));
+          out->insert(out->end(), record.begin(), record.end());
+          m_references.add(signature, record);
+          return true;
+        }
+
+      ++m_num_since_keyframe;
+      ref = m_references.find(signature);
+      if (ref && same_structure(*ref, record))
+        {
+          LogRecord changes;
+          uint64_t delta_size(0), full_size(0);
+
+          for (size_t i = 0; i < record.size(); ++i)
+            {
+              full_size += record[i].size();
+              if (record[i].m_value != (*ref)[i].m_value)
+                {
+                  std::ostringstream index;
+
+                  index << i;
+                  changes.push_back(delta_marker(index.str().c_str(), record[i].m_value));
+                  delta_size += changes.back().size();
+                }
+            }
+
+          if (delta_size < full_size)
+            {
+              str << std::hex << signature << std::dec
+                  << " " << record.size() << " " << changes.size();
+              out->push_back(delta_marker(DELTA_DELTA_MESSAGE, str.str()));
+              out->insert(out->end(), changes.begin(), changes.end());
+              m_references.add(signature, record);
+              return false;
+            }
+        }
+
+      str << record.size();
+      out->push_back(delta_marker(DELTA_RECORD_MESSAGE, str.str()));
+      out->insert(out->end(), record.begin(), record.end());
+      m_references.add(signature, record);
+      return false;
+    }
+
+  private:
+    unsigned int m_keyframe_interval;
+    unsigned int m_num_since_keyframe;
+    DeltaReferences m_references;
+  };
+
+  /* A DeltaDecoder reads a log file as a LogReader does, but if
+   * the file is delta encoded gives the messages as they were
+   * before encoding. A file that is not delta encoded is read
+   * as it is.
+   */
+  class DeltaDecoder
+  {
+  public:
+    explicit
+    DeltaDecoder(const char *filename):
+      m_reader(filename),
+      m_pending_pos(0),
+      m_encoded(false),
+      m_num_lost(0),
+      m_offset(0)
+    {
+      LogMessage msg;
+
+      /* the first message of a file that is not
+       * delta encoded is kept to be given by read()
+       */
+      if (m_reader.read(&msg))
+        {
+          if (msg.m_type == I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE
+              && msg.m_name == DELTA_ENCODING_MESSAGE)
+            {
+              m_encoded = true;
+            }
+          else
+            {
+              m_pending.push_back(msg);
+            }
+        }
+    }
+
+    bool
+    is_open(void) const
+    {
+      return m_reader.is_open();
+    }
+
+    const std::string&
+    filename(void) const
+    {
+      return m_reader.filename();
+    }
+
+    bool
+    is_encoded(void) const
+    {
+      return m_encoded;
+    }
+
+    /* offset in the log as decoded of the next message to be
+     * read; for a file that is not delta encoded this is the
+     * offset in the file.
+     */
+    uint64_t
+    offset(void) const
+    {
+      return m_offset;
+    }
+
+    /* Continue decoding at the offset file_offset of the file,
+     * which must be the start of the file or of a keyframe, and
+     * is at the offset offset in the log as decoded.
+     */
+    bool
+    seek(uint64_t file_offset, uint64_t offset)
+    {
+      m_pending.clear();
+      m_pending_pos = 0;
+      m_references.clear();
+      m_offset = offset;
+      return m_reader.seek(file_offset);
+    }
+
+    /* number of records that could not be decoded because the
+     * record they refer to is missing from the file; decoding
+     * resumes at the next keyframe or full record.
+     */
+    unsigned int
+    num_lost_records(void) const
+    {
+      return m_num_lost;
+    }
+
+    bool
+    read(LogMessage *msg)
+    {
+      if (!read_message(msg))
+        {
+          return false;
+        }
+      m_offset += msg->size();
+      return true;
+    }
+
+  private:
+    bool
+    read_message(LogMessage *msg)
+    {
+      while (m_pending_pos == m_pending.size())
+        {
+          m_pending.clear();
+          m_pending_pos = 0;
+          if (!m_reader.read(msg))
+            {
+              return false;
+            }
+
+          if (msg->m_type != I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE)
+            {
+              return true;
+            }
+
+          if (msg->m_name == DELTA_ENCODING_MESSAGE)
+            {
+              m_encoded = true;
+            }
+          else if (!m_encoded)
+            {
+              return true;
+            }
+          else if (msg->m_name == DELTA_KEYFRAME_MESSAGE)
+            {
+              m_references.clear();
+              read_record(std::strtoul(msg->m_value.c_str(), nullptr, 10));
+            }
+          else if (msg->m_name == DELTA_RECORD_MESSAGE)
+            {
+              read_record(std::strtoul(msg->m_value.c_str(), nullptr, 10));
+            }
+          else if (msg->m_name == DELTA_DELTA_MESSAGE)
+            {
+              read_delta(msg->m_value);
+            }
+          else
+            {
+              return true;
+            }
+        }
+
+      *msg = m_pending[m_pending_pos++];
+      return true;
+    }
+
+    void
+    read_record(unsigned long num_messages)
+    {
+      LogMessage msg;
+
+      m_pending.reserve(num_messages);
+      for (unsigned long i = 0; i < num_messages && m_reader.read(&msg); ++i)
+        {
+          m_pending.push_back(msg);
+        }
+      m_references.add(record_signature(m_pending), m_pending);
+    }
+
+    void
+    read_delta(const std::string &value)
+    {
+      std::istringstream str(value);
+      uint64_t signature(0);
+      size_t num_messages(0), num_changes(0);
+      const LogRecord *ref;
+      LogRecord changes;
+      LogMessage msg;
+
+      str >> std::hex >> signature >> std::dec >> num_messages >> num_changes;
+      for (size_t i = 0; i < num_changes && m_reader.read(&msg); ++i)
+        {
+          changes.push_back(msg);
+        }
+
+      ref = m_references.find(signature);
+      if (!ref || ref->size() != num_messages)
+        {
+          ++m_num_lost;
+          return;
+        }
+
+      m_pending = *ref;
+      for (auto iter = changes.begin(); iter != changes.end(); ++iter)
+        {
+          size_t index(std::strtoul(iter->m_name.c_str(), nullptr, 10));
+          if (index < m_pending.size())
+            {
+              m_pending[index].m_value = iter->m_value;
+            }
+        }
+      m_references.add(signature, m_pending);
+    }
+
+    LogReader m_reader;
+    LogRecord m_pending;
+    size_t m_pending_pos;
+    bool m_encoded;
+    unsigned int m_num_lost;
+    uint64_t m_offset;
+    DeltaReferences m_references;
+  };
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <inttypes.h>
+
+/* Each log file FILE written by i965-blackbox.so can have an
+ * index file, named by log_index_filename(FILE), that lets tools
+ * seek directly to a frame or an execbuffer2 ioctl instead of
+ * scanning the log. The index is text, one entry per line:
+ *
+ *   KIND ID OFFSET N BLOCK_OFFSET_0 ... BLOCK_OFFSET_N-1
+ *
+ * where KIND is LOG_INDEX_FRAME or LOG_INDEX_IOCTL, ID is the
+ * frame number or the execbuffer2 ioctl ID, OFFSET is the offset
+ * in bytes into the log file where the frame or ioctl starts and
+ * BLOCK_OFFSET_i are the offsets of the BLOCK_BEGIN messages of
+ * the N blocks open at OFFSET, outermost first. The last entry
+ * is of KIND LOG_INDEX_CLOSE, its ID is the number of the file in
+ * its session and its OFFSET is where the file starts closing the
+ * blocks that are open. The first entry is of KIND LOG_INDEX_OPEN:
+ * its blocks are the blocks the file restores at its start, its
+ * OFFSET is where the file continues after them and its ID is how
+ * many of the outermost of them continue the blocks closed by the
+ * previous file of the session; the others are new blocks (as
+ * happens when only the most recent execbuffer2 ioctls are kept).
+ *
+ * The offsets of the index of a delta encoded log file (see
+ * log_delta.hpp) are offsets in the log as decoded, and the index
+ * has an entry of KIND LOG_INDEX_KEYFRAME for each keyframe: its
+ * ID is the number of the keyframe in the file, its OFFSET is
+ * where the keyframe starts in the log as decoded and its only
+ * BLOCK_OFFSET (N is 1) is where the keyframe starts in the file,
+ * i.e. where decoding can start.
+ */
+#define LOG_INDEX_FRAME "frame"
+#define LOG_INDEX_IOCTL "ioctl"
+#define LOG_INDEX_CLOSE "close"
+#define LOG_INDEX_OPEN "open"
+#define LOG_INDEX_KEYFRAME "keyframe"
+
+namespace
+{
+  class LogIndexEntry
+  {
+  public:
+    LogIndexEntry(void):
+      m_id(0),
+      m_offset(0)
+    {}
+
+    void
+    write(std::FILE *file) const
+    {
+      std::fprintf(file, "%s %u %" PRIu64 " %u", m_kind.c_str(), m_id,
+                   m_offset, static_cast<unsigned int>(m_block_offsets.size()));
+      for (auto iter = m_block_offsets.begin(); iter != m_block_offsets.end(); ++iter)
+        {
+          std::fprintf(file, " %" PRIu64, *iter);
+        }
+      std::fprintf(file, "\n");
+    }
+
+    /* Read the next entry from an index file, returns
+     * false at the end of the file or on a malformed entry.
+     */
+    bool
+    read(std::FILE *file)
+    {
+      char kind[32];
+      unsigned int num_blocks;
+
+      if (std::fscanf(file, "%31s %u %" SCNu64 " %u",
+                      kind, &m_id, &m_offset, &num_blocks) != 4)
+        {
+          return false;
+        }
+
+      m_kind = kind;
+      m_block_offsets.resize(num_blocks);
+      for (unsigned int i = 0; i < num_blocks; ++i)
+        {
+          if (std::fscanf(file, "%" SCNu64, &m_block_offsets[i]) != 1)
+            {
+              return false;
+            }
+        }
+      return true;
+    }
+
+    std::string m_kind;
+    unsigned int m_id;
+    uint64_t m_offset;
+    std::vector<uint64_t> m_block_offsets;
+  };
+}
+
+static
+std::string
+log_index_filename(const std::string &log_filename)
+{
+  return log_filename + ".index";
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <stdint.h>
+
+#include "i965_batchbuffer_logger_output.h"
+
+namespace
+{
+  /* A LogMessage is a single message of a log file
+   * as written by Session::write_to_file().
+   */
+  class LogMessage
+  {
+  public:
+    enum i965_batchbuffer_logger_message_type_t m_type;
+    std::string m_name;
+    std::string m_value;
+
+    /* number of bytes the message takes in the file */
+    uint64_t
+    size(void) const
+    {
+      return sizeof(struct i965_batchbuffer_logger_header)
+        + m_name.length() + m_value.length();
+    }
+
+    void
+    write(std::FILE *file) const
+    {
+      struct i965_batchbuffer_logger_header hdr;
+
+      hdr.type = m_type;
+      hdr.name_length = m_name.length();
+      hdr.value_length = m_value.length();
+      std::fwrite(&hdr, sizeof(hdr), 1, file);
+      std::fwrite(m_name.data(), sizeof(char), m_name.length(), file);
+      std::fwrite(m_value.data(), sizeof(char), m_value.length(), file);
+    }
+  };
+
+  /* A LogReader reads the messages of a log file one at a
+   * time, so that arbitrarily large files can be streamed.
+   */
+  class LogReader
+  {
+  public:
+    explicit
+    LogReader(const char *filename):
+      m_filename(filename),
+      m_offset(0)
+    {
+      m_file = std::fopen(filename, "rb");
+    }
+
+    ~LogReader()
+    {
+      if (m_file)
+        {
+          std::fclose(m_file);
+        }
+    }
+
+    bool
+    is_open(void) const
+    {
+      return m_file != nullptr;
+    }
+
+    const std::string&
+    filename(void) const
+    {
+      return m_filename;
+    }
+
+    /* offset in bytes of the next message to be read */
+    uint64_t
+    offset(void) const
+    {
+      return m_offset;
+    }
+
+    /* Seek to the message at the named offset, which
+     * must be the offset of the start of a message.
+     */
+    bool
+    seek(uint64_t offset)
+    {
+      if (!m_file || fseeko(m_file, offset, SEEK_SET) != 0)
+        {
+          return false;
+        }
+      m_offset = offset;
+      return true;
+    }
+
+    /* Read the next message, returns false at the end of
+     * the file or if the file is truncated.
+     */
+    bool
+    read(LogMessage *msg)
+    {
+      struct i965_batchbuffer_logger_header hdr;
+
+      if (!m_file || std::fread(&hdr, sizeof(hdr), 1, m_file) != 1)
+        {
+          return false;
+        }
+
+      msg->m_type = static_cast<enum i965_batchbuffer_logger_message_type_t>(hdr.type);
+      if (!read_string(hdr.name_length, &msg->m_name)
+          || !read_string(hdr.value_length, &msg->m_value))
+        {
+          return false;
+        }
+
+      m_offset += msg->size();
+      return true;
+    }
+
+  private:
+    bool
+    read_string(uint32_t length, std::string *dst)
+    {
+      dst->resize(length);
+      return length == 0
+        || std::fread(&(*dst)[0], sizeof(char), length, m_file) == length;
+    }
+
+    std::string m_filename;
+    std::FILE *m_file;
+    uint64_t m_offset;
+  };
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+#
+# Runs the GPU frame timing of i965-blackbox.so against the stub
+# GL of stub_gl.cpp and compares the GPU frame times it reports,
+# and the GPU frame time values it writes to the log (as dumped by
+# log_values.cpp), with gpu_frame_timing.expected. Usage:
+#
+# check-gpu-frame-timing.sh BLACKBOX_SO STUB_GL_SO DRIVER LOG_VALUES LOGGER_LIB_DIR
+
+if [ "$#" -ne 5 ]; then
+    echo "Usage: $0 BLACKBOX_SO STUB_GL_SO DRIVER LOG_VALUES LOGGER_LIB_DIR"
+    exit 1
+fi
+
+blackbox=$(realpath "$1")
+stub_gl=$(realpath "$2")
+driver=$(realpath "$3")
+log_values=$(realpath "$4")
+logger_lib_dir="$5"
+expected=$(dirname "$(realpath "$0")")/gpu_frame_timing.expected
+
+# the logs made by the runs are not needed
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+
+# run_case DESCRIPTION GL_VERSION RING_SIZE NUM_CONTEXTS
+run_case() {
+    case_dir=$(mktemp -d -p "$work_dir")
+    echo "# $1"
+    (cd "$case_dir" && \
+        env STUB_GL_VERSION="$2" I965_BLACKBOX_GPU_FRAME_TIMING="$3" \
+        I965_BLACKBOX_GL_LIB="$stub_gl" LD_LIBRARY_PATH="$logger_lib_dir" \
+        LD_PRELOAD="$blackbox" "$driver" 8 "$4") \
+        | grep -e "timestamp queries" -e "GPU time" -e "stub GL:"
+    "$log_values" "$case_dir"/i965_blackbox_log-1.*[0-9] \
+        | grep "GPU frame time"
+}
+
+actual="$work_dir/actual"
+{
+    run_case "ring of 3 queries: all frames are timed" 3.3 3 1
+    run_case "ring of 1 query: the ring is full at every other swap, no frame is timed" 3.3 1 1
+    run_case "GL 3.0 without ARB_timer_query: timing is disabled" 3.0 3 1
+    run_case "two contexts swapped in turn: each is timed with its own queries" 3.3 3 2
+} > "$actual"
+
+if diff -u "$expected" "$actual"; then
+    echo "GPU frame timing: PASS"
+else
+    echo "GPU frame timing: FAIL"
+    exit 1
+fi
@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdlib>
+#include <stdint.h>
+
+/*
+ * Driver for the GPU frame timing test: swaps once without a
+ * current context, then swaps the number of times given by its
+ * first argument (default 8) each of the number of contexts of
+ * the stub GL given by its second argument (default 1), making
+ * each context current in turn before its swap; it does nothing
+ * else, so that with i965-blackbox.so preloaded each swap is a
+ * frame boundary.
+ */
+
+extern "C" int glXMakeCurrent(void *dpy, unsigned long drawable, void *ctx);
+extern "C" void glXSwapBuffers(void *dpy, unsigned long drawable);
+
+int
+main(int argc, char **argv)
+{
+  int num_frames, num_contexts;
+
+  num_frames = (argc > 1) ? std::atoi(argv[1]) : 8;
+  num_contexts = (argc > 2) ? std::atoi(argv[2]) : 1;
+
+  glXSwapBuffers(nullptr, 0);
+  for (int i = 0; i < num_frames; ++i)
+    {
+      for (int c = 1; c <= num_contexts; ++c)
+        {
+          glXMakeCurrent(nullptr, 0, reinterpret_cast<void*>(static_cast<uintptr_t>(c)));
+          glXSwapBuffers(nullptr, 0);
+        }
+    }
+  return 0;
+}
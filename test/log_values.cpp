@@ -0,0 +1,89 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "log_reader.hpp"
+
+/*
+ * Prints each value message of the log files given as arguments
+ * on a line of its own as "BLOCK: NAME: VALUE" where BLOCK is the
+ * name of the innermost block the message is in (empty at top
+ * level), so that tests can check what a run logged and where.
+ */
+
+namespace {
+
+std::string
+strip_nuls(const std::string &str)
+{
+  std::string::size_type end;
+
+  end = str.find_last_not_of('\0');
+  return (end == std::string::npos) ? std::string() : str.substr(0, end + 1);
+}
+
+} //anonymous namespace
+
+int
+main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i)
+    {
+      LogReader reader(argv[i]);
+      std::vector<std::string> blocks;
+      LogMessage msg;
+
+      if (!reader.is_open())
+        {
+          std::fprintf(stderr, "Failed to open file %s\n", argv[i]);
+          return 1;
+        }
+
+      while (reader.read(&msg))
+        {
+          switch (msg.m_type)
+            {
+            case I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_BEGIN:
+              blocks.push_back(strip_nuls(msg.m_name));
+              break;
+
+            case I965_BATCHBUFFER_LOGGER_MESSAGE_BLOCK_END:
+              if (!blocks.empty())
+                {
+                  blocks.pop_back();
+                }
+              break;
+
+            case I965_BATCHBUFFER_LOGGER_MESSAGE_VALUE:
+              std::printf("%s: %s: %s\n",
+                          blocks.empty() ? "" : blocks.back().c_str(),
+                          strip_nuls(msg.m_name).c_str(),
+                          strip_nuls(msg.m_value).c_str());
+              break;
+            }
+        }
+    }
+  return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+/*
+ * A stub of libGL.so for testing the GPU frame timing of
+ * i965-blackbox.so without a GPU: it provides only the functions
+ * the GpuFrameTimer uses, glXMakeCurrent and glXSwapBuffers. A
+ * context is a small integer C (counting from 1) passed as the
+ * GLXContext to glXMakeCurrent; 0 makes no context current. The
+ * timestamp of a query is synthetic: frame N (counting from 1) of
+ * context C takes C * 16000000 + (N - 1) * 1000 ns of GPU time,
+ * and the result of a query becomes available two swaps of its
+ * context after it is issued.
+ *
+ * The query names of each context are distinct from those of the
+ * other contexts; using a query on a context other than the one
+ * that created it prints an error, as does a query or GL version
+ * call without a current context.
+ *
+ * The GL version reported is given by the environmental variable
+ * STUB_GL_VERSION, default "3.3"; no extensions are reported.
+ */
+
+#define STUB_MAX_CONTEXTS 8
+#define STUB_MAX_QUERIES 64
+
+namespace {
+
+class StubContext
+{
+public:
+  unsigned int m_frame;
+  unsigned int m_num_queries;
+  unsigned int m_query_frame[STUB_MAX_QUERIES];
+};
+
+StubContext contexts[STUB_MAX_CONTEXTS];
+unsigned int current = 0;
+
+uint64_t
+frame_timestamp(uint64_t c, uint64_t f)
+{
+  return f * c * 16000000u + f * (f - 1) / 2 * 1000u;
+}
+
+/* Returns the index into StubContext::m_query_frame of the
+ * query id of the current context, or -1 after printing an
+ * error if the query is not one of the current context.
+ */
+int
+query_index(unsigned int id, const char *function)
+{
+  unsigned int i;
+
+  i = id % STUB_MAX_QUERIES;
+  if (current == 0 || id / STUB_MAX_QUERIES != current
+      || i == 0 || i > contexts[current].m_num_queries)
+    {
+      std::printf("stub GL: GL_INVALID_OPERATION in %s\n", function);
+      return -1;
+    }
+  return i - 1;
+}
+
+} //anonymous namespace
+
+extern "C"
+const unsigned char*
+glGetString(unsigned int name)
+{
+  const char *version;
+
+  if (current == 0)
+    {
+      std::printf("stub GL: no current context in glGetString\n");
+      return nullptr;
+    }
+
+  if (name != 0x1F02) // GL_VERSION
+    {
+      return reinterpret_cast<const unsigned char*>("");
+    }
+
+  version = std::getenv("STUB_GL_VERSION");
+  return reinterpret_cast<const unsigned char*>(version ? version : "3.3");
+}
+
+extern "C"
+const unsigned char*
+glGetStringi(unsigned int, unsigned int)
+{
+  return nullptr;
+}
+
+extern "C"
+void
+glGetIntegerv(unsigned int, int *data)
+{
+  *data = 0;
+}
+
+extern "C"
+void
+glGenQueries(int n, unsigned int *ids)
+{
+  StubContext &ctx(contexts[current]);
+
+  for (int i = 0; i < n; ++i)
+    {
+      ids[i] = 0;
+      if (current != 0 && ctx.m_num_queries + 1 < STUB_MAX_QUERIES)
+        {
+          ids[i] = current * STUB_MAX_QUERIES + ++ctx.m_num_queries;
+        }
+    }
+}
+
+extern "C"
+void
+glQueryCounter(unsigned int id, unsigned int)
+{
+  int i;
+
+  i = query_index(id, "glQueryCounter");
+  if (i >= 0)
+    {
+      contexts[current].m_query_frame[i] = contexts[current].m_frame;
+    }
+}
+
+extern "C"
+void
+glGetQueryObjectiv(unsigned int id, unsigned int, int *params)
+{
+  int i;
+
+  i = query_index(id, "glGetQueryObjectiv");
+  *params = (i >= 0
+             && contexts[current].m_frame >= contexts[current].m_query_frame[i] + 2);
+}
+
+extern "C"
+void
+glGetQueryObjectui64v(unsigned int id, unsigned int, uint64_t *params)
+{
+  int i;
+
+  i = query_index(id, "glGetQueryObjectui64v");
+  *params = (i >= 0) ?
+    frame_timestamp(current, contexts[current].m_query_frame[i]) :
+    0;
+}
+
+extern "C"
+void*
+glXGetCurrentContext(void)
+{
+  return reinterpret_cast<void*>(static_cast<uintptr_t>(current));
+}
+
+extern "C"
+int
+glXMakeCurrent(void*, unsigned long, void *ctx)
+{
+  current = static_cast<unsigned int>(reinterpret_cast<uintptr_t>(ctx));
+  if (current >= STUB_MAX_CONTEXTS)
+    {
+      current = 0;
+      return 0;
+    }
+  return 1;
+}
+
+extern "C"
+void
+glXSwapBuffers(void*, unsigned long)
+{
+  if (current != 0)
+    {
+      ++contexts[current].m_frame;
+    }
+}